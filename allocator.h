@@ -14,6 +14,14 @@
 // maximum size of block that must be accommodated
 #define MAX_REQUEST_SIZE (1 << 30)
 
+// maximum size of block an arena accommodates, leaving room under MAX_REQUEST_SIZE
+// for the header of the chunk that holds it
+#define ARENA_MAX_REQUEST_SIZE (MAX_REQUEST_SIZE - 64)
+
+// whether the allocator may be called from several threads at once, which is
+// only true of the explicit allocator built with -DTHREADED
+extern const bool allocator_thread_safe;
+
 
 
 /* Function: myinit
@@ -34,6 +42,14 @@ bool myinit(void *heap_start, size_t heap_size);
 void *mymalloc(size_t requested_size);
 
 
+/* Function: mycalloc
+ * ------------------
+ * Custom version of calloc: returns a block of nmemb * size bytes, all zero,
+ * or NULL if the product overflows or the request can't be met.
+ */
+void *mycalloc(size_t nmemb, size_t size);
+
+
 /* Function: myrealloc
  * -------------------
  * Custom version of realloc.
@@ -48,6 +64,127 @@ void *myrealloc(void *old_ptr, size_t new_size);
 void myfree(void *ptr);
 
 
+/* Function: myfree_sized
+ * ----------------------
+ * Like myfree, for a caller that knows the block's size: anything from the
+ * size it was last allocated or reallocated with up to its usable size.
+ */
+void myfree_sized(void *ptr, size_t size);
+
+
+/* Function: myusable_size
+ * -----------------------
+ * Returns how many bytes of the block the client may use, at least the size
+ * it was last allocated or reallocated with, or 0 for NULL.
+ */
+size_t myusable_size(void *ptr);
+
+
+/* Functions: mymalloc_batch, myfree_batch
+ * ---------------------------------------
+ * mymalloc_batch allocates up to n blocks of size bytes each, storing them in
+ * out, and returns how many it allocated, fewer than n only if the heap ran
+ * out of memory. myfree_batch frees the n blocks in ptrs, any of which may be
+ * NULL. It sorts ptrs in place by address, so the caller's order is not kept.
+ */
+size_t mymalloc_batch(size_t size, size_t n, void *out[]);
+void myfree_batch(void *ptrs[], size_t n);
+
+
+/* Function: myaligned_alloc
+ * -------------------------
+ * Custom version of aligned_alloc: returns a block of size bytes whose
+ * address is a multiple of alignment, a power of 2, or NULL if the request
+ * can't be met. The block is freed and resized like any other.
+ */
+void *myaligned_alloc(size_t alignment, size_t size);
+
+
+/* Function: myposix_memalign
+ * --------------------------
+ * Custom version of posix_memalign: stores a block of size bytes aligned to
+ * alignment in *memptr and returns 0. Returns EINVAL, leaving *memptr alone,
+ * if alignment is not a power of 2 and a multiple of sizeof(void *), or
+ * ENOMEM if the block can't be allocated.
+ */
+int myposix_memalign(void **memptr, size_t alignment, size_t size);
+
+
+/* Type: arena_t
+ * -------------
+ * An arena (region) for allocations that are freed together. Blocks are
+ * carved in order from chunks taken from the heap with mymalloc, so they cost
+ * a pointer bump, and are never freed one at a time: arena_release_to_mark
+ * frees everything allocated since a mark, and arena_reset everything.
+ */
+typedef struct arena arena_t;
+
+// a point in an arena's allocations that it can later be released back to
+typedef struct {
+    void *chunk;
+    size_t used;
+} arena_mark_t;
+
+
+/* Functions: arena_create, arena_destroy
+ * --------------------------------------
+ * arena_create returns a new, empty arena that takes chunks of chunk_size
+ * bytes (or a default size if 0) from the heap, or NULL if chunk_size is over
+ * ARENA_MAX_REQUEST_SIZE or the heap is out of memory. arena_destroy gives all of an arena's memory back to the heap.
+ */
+arena_t *arena_create(size_t chunk_size);
+void arena_destroy(arena_t *arena);
+
+
+/* Function: arena_alloc
+ * ---------------------
+ * Returns an ALIGNMENT-aligned block of requested_size bytes from the arena,
+ * or NULL if the size is 0 or over ARENA_MAX_REQUEST_SIZE or the heap is out of
+ * memory. A request larger than the arena's chunk size gets a chunk of its own.
+ */
+void *arena_alloc(arena_t *arena, size_t requested_size);
+
+
+/* Functions: arena_mark, arena_release_to_mark, arena_reset
+ * ---------------------------------------------------------
+ * arena_mark records the arena's current position. arena_release_to_mark
+ * frees every block allocated since the mark was taken, which invalidates
+ * any marks taken after it. arena_reset frees every block in the arena,
+ * invalidating all of its marks. Chunks emptied this way go back to the
+ * heap, apart from one kept for the arena's next allocations.
+ */
+arena_mark_t arena_mark(arena_t *arena);
+void arena_release_to_mark(arena_t *arena, arena_mark_t mark);
+void arena_reset(arena_t *arena);
+
+
+/* Type: heapstats_t
+ * -----------------
+ * A snapshot of the heap's state, like mallinfo. The top of the heap, the
+ * free space after the last block in use, is not counted as free: it is
+ * the part of the segment the heap has not grown into, and heap_extent
+ * ends where it starts.
+ */
+typedef struct {
+    size_t in_use;          // payload bytes of the blocks handed out, after rounding
+    size_t free;            // payload bytes of the free blocks below the top
+    size_t free_blocks;     // number of free blocks below the top
+    size_t largest_free;    // payload bytes of the largest of those
+    double fragmentation;   // 1 - largest_free / free, or 0 if nothing is free
+    size_t peak_in_use;     // most in_use has been since myinit
+    size_t heap_extent;     // bytes from the start of the heap to the top
+    size_t calloc_bytes;    // bytes requested from mycalloc since myinit
+    size_t calloc_written;  // how many of those mycalloc zeroed by writing to them
+} heapstats_t;
+
+
+/* Function: myheapstats
+ * ---------------------
+ * Returns the heap's current statistics.
+ */
+heapstats_t myheapstats(void);
+
+
 /* Function: validate_heap
  * -----------------------
  * This is the hook for your heap consistency checker. Returns true
@@ -0,0 +1,179 @@
+/* File: arena.c
+ * -------------
+ * Arenas built on top of the heap allocator. An arena allocates by bumping a
+ * pointer through its current chunk, a block taken from the heap with
+ * mymalloc, and chains a new chunk when that one fills up. Chunks are linked
+ * newest first, so a mark is just a chunk and an offset into it, and
+ * releasing to a mark gives back every newer chunk with myfree. Arenas work
+ * with any of the allocators; with bump.c, whose free does nothing, released
+ * chunks are simply never reused by the heap.
+ */
+
+#include <stdint.h>
+#include "./allocator.h"
+
+// default number of bytes each chunk holds for allocations
+#define DEFAULT_CHUNK_SIZE (16 * 1024)
+
+/* type chunk for the header at the start of each chunk, holding the chunk it
+ * was chained after and how much of the space following the header is in use.
+ */
+typedef struct chunk {
+    struct chunk *prev;
+    size_t size;
+    size_t used;
+} chunk;
+
+_Static_assert(sizeof(chunk) <= MAX_REQUEST_SIZE - ARENA_MAX_REQUEST_SIZE,
+    "a chunk holding the largest arena request must not exceed MAX_REQUEST_SIZE");
+
+struct arena {
+    chunk *current;     // newest chunk, or NULL if the arena holds none
+    chunk *spare;       // an emptied standard-size chunk kept for reuse, or NULL
+    size_t chunk_size;
+};
+
+/* Function: align_up
+ * ------------------
+ * This function rounds the given size up to a multiple of ALIGNMENT.
+ */
+static size_t align_up(size_t sz) {
+    return (sz + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+}
+
+/* Function: chunk_data
+ * --------------------
+ * This function returns the start of the space for allocations in a chunk,
+ * which follows its header at the next ALIGNMENT boundary.
+ */
+static char *chunk_data(chunk *c) {
+    return (char *)c + align_up(sizeof(chunk));
+}
+
+/* Function: add_chunk
+ * -------------------
+ * This function chains a new chunk with room for at least needed bytes onto the
+ * arena and returns it, reusing the spare chunk if it is big enough. It returns
+ * NULL if the heap is out of memory.
+ */
+static chunk *add_chunk(arena_t *arena, size_t needed) {
+    chunk *c;
+    if (arena->spare != NULL && arena->spare->size >= needed) {
+        c = arena->spare;
+        arena->spare = NULL;
+    } else {
+        size_t size = needed > arena->chunk_size ? needed : arena->chunk_size;
+        c = mymalloc(align_up(sizeof(chunk)) + size);
+        if (c == NULL) {
+            return NULL;
+        }
+        c->size = size;
+    }
+    c->prev = arena->current;
+    c->used = 0;
+    arena->current = c;
+    return c;
+}
+
+/* Function: release_chunk
+ * -----------------------
+ * This function gives an emptied chunk back to the heap, unless it is of the
+ * standard size and no spare is kept yet, in which case it becomes the spare.
+ */
+static void release_chunk(arena_t *arena, chunk *c) {
+    if (arena->spare == NULL && c->size == arena->chunk_size) {
+        arena->spare = c;
+    } else {
+        myfree(c);
+    }
+}
+
+/* Function: arena_create
+ * ----------------------
+ * This function takes the arena's own struct from the heap and returns it with no
+ * chunks yet; the first chunk is only taken by the first allocation. A chunk size
+ * of 0 means DEFAULT_CHUNK_SIZE, and any other is rounded up to the alignment.
+ */
+arena_t *arena_create(size_t chunk_size) {
+    if (chunk_size > ARENA_MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+    arena_t *arena = mymalloc(sizeof(arena_t));
+    if (arena == NULL) {
+        return NULL;
+    }
+    arena->current = NULL;
+    arena->spare = NULL;
+    arena->chunk_size = align_up(chunk_size != 0 ? chunk_size : DEFAULT_CHUNK_SIZE);
+    return arena;
+}
+
+/* Function: arena_destroy
+ * -----------------------
+ * This function resets the arena, then gives back the spare chunk the reset kept and
+ * the arena's own struct.
+ */
+void arena_destroy(arena_t *arena) {
+    arena_reset(arena);
+    myfree(arena->spare);
+    myfree(arena);
+}
+
+/* Function: arena_alloc
+ * ---------------------
+ * This function bumps the current chunk's used count past the aligned request and
+ * returns where it stood. If the chunk has too little room left, a new chunk is
+ * chained on and the rest of the old one goes unused until it is released.
+ */
+void *arena_alloc(arena_t *arena, size_t requested_size) {
+    if (requested_size == 0 || requested_size > ARENA_MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+    size_t needed = align_up(requested_size);
+    chunk *c = arena->current;
+    if (c == NULL || c->size - c->used < needed) {
+        c = add_chunk(arena, needed);
+        if (c == NULL) {
+            return NULL;
+        }
+    }
+    void *ptr = chunk_data(c) + c->used;
+    c->used += needed;
+    return ptr;
+}
+
+/* Function: arena_mark
+ * --------------------
+ * This function returns the current chunk and how much of it is used, or an empty
+ * mark if the arena holds no chunk.
+ */
+arena_mark_t arena_mark(arena_t *arena) {
+    arena_mark_t mark = { arena->current, arena->current ? arena->current->used : 0 };
+    return mark;
+}
+
+/* Function: arena_release_to_mark
+ * -------------------------------
+ * This function releases every chunk chained on after the mark's chunk, newest
+ * first, and rewinds the mark's chunk to the used count it had.
+ */
+void arena_release_to_mark(arena_t *arena, arena_mark_t mark) {
+    while (arena->current != NULL && arena->current != mark.chunk) {
+        chunk *c = arena->current;
+        arena->current = c->prev;
+        release_chunk(arena, c);
+    }
+    if (arena->current != NULL) {
+        arena->current->used = mark.used;
+    }
+}
+
+/* Function: arena_reset
+ * ---------------------
+ * This function releases the arena back to an empty mark, which releases every
+ * chunk it holds.
+ */
+void arena_reset(arena_t *arena) {
+    arena_mark_t empty = { NULL, 0 };
+    arena_release_to_mark(arena, empty);
+}
@@ -0,0 +1,169 @@
+/* File: bench_threads.c
+ * ---------------------
+ * Multi-threaded stress benchmark for an allocator built with -DTHREADED.
+ * Each thread keeps a window of live blocks and repeatedly frees a random
+ * one and allocates a replacement of random size, touching every block it
+ * gets so that overlapping blocks would be noticed. The benchmark is run at
+ * 1, 2, 4, 8 and 16 threads and reports the total throughput at each count.
+ *
+ * Usage: bench_threads [-n ops-per-thread] [-l live-blocks-per-thread]
+ */
+
+#include <error.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "allocator.h"
+#include "segment.h"
+
+// default number of malloc/free pairs each thread performs
+#define DEFAULT_OPS 1000000
+// default number of live blocks each thread holds at once
+#define DEFAULT_LIVE 256
+// largest thread count benchmarked; counts double from 1 up to this
+#define MAX_THREADS 16
+// every this many requests is a large block instead of a small one
+#define LARGE_EVERY 64
+// size bounds for the small and large blocks requested
+#define SMALL_MAX 256
+#define LARGE_MAX 4096
+
+const long HEAP_SIZE = 1L << 32;
+
+// struct for one worker thread's parameters and result
+typedef struct {
+    int id;
+    long nops;
+    int nlive;
+    bool failed;
+} worker_t;
+
+/* Function: next_random
+ * ---------------------
+ * A small xorshift generator so each thread has its own random stream
+ * without contending on the libc rand() lock.
+ */
+static unsigned long next_random(unsigned long *state) {
+    unsigned long x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+/* Function: random_size
+ * ---------------------
+ * Returns a request size, mostly small with an occasional larger block.
+ */
+static size_t random_size(unsigned long *state) {
+    unsigned long r = next_random(state);
+    if (r % LARGE_EVERY == 0) {
+        return SMALL_MAX + r / LARGE_EVERY % (LARGE_MAX - SMALL_MAX) + 1;
+    }
+    return r / LARGE_EVERY % SMALL_MAX + 1;
+}
+
+/* Function: run_worker
+ * --------------------
+ * Thread body: fills a window of live blocks, then repeatedly replaces a
+ * random one. Each block's first and last bytes hold a tag that is checked
+ * before the block is freed.
+ */
+static void *run_worker(void *arg) {
+    worker_t *w = arg;
+    unsigned long state = 0x9E3779B97F4A7C15UL * (w->id + 1);
+    char **live = calloc(w->nlive, sizeof(char *));
+    size_t *sizes = calloc(w->nlive, sizeof(size_t));
+    if (live == NULL || sizes == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+
+    for (long i = 0; i < w->nops + w->nlive; i++) {
+        int slot = i < w->nlive ? i : next_random(&state) % w->nlive;
+        char tag = (char)(slot ^ w->id);
+        if (live[slot] != NULL) {
+            if (live[slot][0] != tag || live[slot][sizes[slot] - 1] != tag) {
+                w->failed = true;
+            }
+            myfree(live[slot]);
+        }
+        sizes[slot] = random_size(&state);
+        live[slot] = mymalloc(sizes[slot]);
+        if (live[slot] == NULL) {
+            w->failed = true;
+            break;
+        }
+        live[slot][0] = tag;
+        live[slot][sizes[slot] - 1] = tag;
+    }
+
+    for (int slot = 0; slot < w->nlive; slot++) {
+        myfree(live[slot]);
+    }
+    free(live);
+    free(sizes);
+    return NULL;
+}
+
+/* Function: run_benchmark
+ * -----------------------
+ * Re-initializes the heap, runs nthreads workers to completion and prints the
+ * throughput in malloc/free pairs per second. Returns false if any worker saw
+ * corrupted data or a failed allocation.
+ */
+static bool run_benchmark(int nthreads, long nops, int nlive) {
+    init_heap_segment(HEAP_SIZE);
+    if (!myinit(heap_segment_start(), heap_segment_size())) {
+        error(1, 0, "myinit() returned false");
+    }
+
+    pthread_t threads[MAX_THREADS];
+    worker_t workers[MAX_THREADS];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < nthreads; i++) {
+        workers[i] = (worker_t){.id = i, .nops = nops, .nlive = nlive, .failed = false};
+        pthread_create(&threads[i], NULL, run_worker, &workers[i]);
+    }
+    bool success = true;
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+        success &= !workers[i].failed;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double total = (double)nthreads * nops;
+    printf("%2d threads: %12.0f pairs/sec (%.3f s)%s\n", nthreads, total / secs, secs,
+        success ? "" : "  ALLOCATOR FAILURE");
+    return success;
+}
+
+int main(int argc, char *argv[]) {
+    long nops = DEFAULT_OPS;
+    int nlive = DEFAULT_LIVE;
+    int c;
+    while ((c = getopt(argc, argv, "n:l:")) != -1) {
+        if (c == 'n') {
+            nops = atol(optarg);
+        } else if (c == 'l') {
+            nlive = atoi(optarg);
+        } else {
+            error(1, 0, "Usage: %s [-n ops-per-thread] [-l live-blocks-per-thread]", argv[0]);
+        }
+    }
+    if (nops <= 0 || nlive <= 0) {
+        error(1, 0, "Op and live block counts must be positive.");
+    }
+
+    int nfailures = 0;
+    for (int nthreads = 1; nthreads <= MAX_THREADS; nthreads *= 2) {
+        nfailures += !run_benchmark(nthreads, nops, nlive);
+    }
+    return nfailures;
+}
@@ -9,18 +9,31 @@
  * This shows the very simplest of approaches; there are better options!
  */
 
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "./allocator.h"
 #include "./debug_break.h"
+#include "./segment.h"
 
 // how many bytes are printed per line in dump_heap
 #define BYTES_PER_LINE 32
+// granularity in which heap memory is committed
+#define COMMIT_CHUNK (64 * 1024)
+// bytes before each block recording its payload size, for myusable_size
+#define HEADER_SIZE 8
 
 static void *segment_start;
 static size_t segment_size;
 static size_t nused;
+static size_t ncommitted;
+// bytes requested from mycalloc since myinit, all of them zeroed by writing
+static size_t calloc_bytes;
+
+// nused is bumped without a lock, so only one thread may call in at a time
+const bool allocator_thread_safe = false;
 
 
 /* Function: myinit
@@ -32,6 +45,8 @@ bool myinit(void *heap_start, size_t heap_size) {
     segment_start = heap_start;
     segment_size = heap_size;
     nused = 0;
+    ncommitted = 0;
+    calloc_bytes = 0;
     return true;
 }
 
@@ -49,23 +64,88 @@ size_t roundup(size_t sz, size_t mult) {
  * This function satisfies an allocation request by placing
  * the allocated block at the end of the heap.  No search means
  * it is fast, but no memory recycling means very poor utilization.
+ * Memory is committed in COMMIT_CHUNK steps as the end of the heap grows.
+ * The only housekeeping is a header holding the payload size.
  */
 void *mymalloc(size_t requested_size) {
-    size_t needed = roundup(requested_size, ALIGNMENT);
+    size_t needed = roundup(requested_size, ALIGNMENT) + HEADER_SIZE;
     if (needed + nused > segment_size) {
         return NULL;
     }
-    void *ptr = (char *)segment_start + nused;
+    if (needed + nused > ncommitted) {
+        size_t new_committed = roundup(needed + nused, COMMIT_CHUNK);
+        if (new_committed > segment_size) {
+            new_committed = segment_size;
+        }
+        if (!segment_commit((char *)segment_start + ncommitted, new_committed - ncommitted)) {
+            return NULL;
+        }
+        ncommitted = new_committed;
+    }
+    void *ptr = (char *)segment_start + nused + HEADER_SIZE;
+    *(size_t *)((char *)ptr - HEADER_SIZE) = needed - HEADER_SIZE;
     nused += needed;
     return ptr;
 }
 
+/* Function: mycalloc
+ * ------------------
+ * This function allocates a block with mymalloc and zeroes it with memset. The end
+ * of the heap may have been used before myinit last reset it, so nothing is
+ * known to be zero.
+ */
+void *mycalloc(size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        return NULL;
+    }
+    void *ptr = mymalloc(total);
+    if (ptr != NULL) {
+        memset(ptr, 0, total);
+        calloc_bytes += total;
+    }
+    return ptr;
+}
+
 /* Function: myfree
  * ----------------
  * This function does nothing - fast!... but lame :(
  */
 void myfree(void *ptr) {}
 
+/* Function: mymalloc_batch
+ * ------------------------
+ * This function allocates the blocks one at a time with mymalloc.
+ */
+size_t mymalloc_batch(size_t size, size_t n, void *out[]) {
+    size_t done = 0;
+    while (done < n && (out[done] = mymalloc(size)) != NULL) {
+        done++;
+    }
+    return done;
+}
+
+/* Function: myfree_batch
+ * ----------------------
+ * This function does nothing, like myfree.
+ */
+void myfree_batch(void *ptrs[], size_t n) {}
+
+/* Function: myfree_sized
+ * ----------------------
+ * This function does nothing either, whatever the size.
+ */
+void myfree_sized(void *ptr, size_t size) {}
+
+/* Function: myusable_size
+ * -----------------------
+ * This function returns the payload size recorded in the block's header: the
+ * requested size rounded up to ALIGNMENT.
+ */
+size_t myusable_size(void *ptr) {
+    return ptr != NULL ? *(size_t *)((char *)ptr - HEADER_SIZE) : 0;
+}
+
 /* Function: realloc
  * -----------------
  * This function satisfies requests for resizing previously-allocated memory
@@ -74,11 +154,64 @@ void myfree(void *ptr) {}
  */
 void *myrealloc(void *old_ptr, size_t new_size) {
     void *new_ptr = mymalloc(new_size);
-    memcpy(new_ptr, old_ptr, new_size);
+    size_t old_size = myusable_size(old_ptr);
+    memcpy(new_ptr, old_ptr, old_size < new_size ? old_size : new_size);
     myfree(old_ptr);
     return new_ptr;
 }
 
+/* Function: myaligned_alloc
+ * -------------------------
+ * This function satisfies an aligned allocation by skipping the end of the heap
+ * forward to the next multiple of the alignment before allocating there. The
+ * skipped bytes are never used.
+ */
+void *myaligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+    uintptr_t end = (uintptr_t)segment_start + nused + HEADER_SIZE;
+    size_t padding = roundup(end, alignment) - end;
+    if (padding > segment_size - nused) {
+        return NULL;
+    }
+    nused += padding;
+    void *ptr = mymalloc(size);
+    if (ptr == NULL) {
+        nused -= padding;
+    }
+    return ptr;
+}
+
+/* Function: myposix_memalign
+ * --------------------------
+ * This function checks the alignment and hands the request to myaligned_alloc,
+ * reporting the outcome as posix_memalign does.
+ */
+int myposix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || 
+        alignment % sizeof(void *) != 0) {
+        return EINVAL;
+    }
+    void *ptr = myaligned_alloc(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+/* Function: myheapstats
+ * ---------------------
+ * This function returns the heap statistics. Nothing is ever freed, so every byte
+ * below the end of the heap counts as in use and nothing counts as free.
+ */
+heapstats_t myheapstats(void) {
+    heapstats_t stats = { .in_use = nused, .peak_in_use = nused, .heap_extent = nused,
+        .calloc_bytes = calloc_bytes, .calloc_written = calloc_bytes };
+    return stats;
+}
+
 /* Function: validate_heap
  * -----------------------
  * This function checks for potential errors/inconsistencies in the heap data
@@ -100,8 +233,8 @@ bool validate_heap() {
  * This function is not called from anywhere, it is just here to
  * demonstrate how such a function might be a useful debugging aid.
  * You can then call the function from gdb to view the contents of the heap segment. 
- * For the bump allocator, the heap contains no block headers or 
- * heap housekeeping to provide structure, so all that can be displayed 
+ * For the bump allocator, the heap contains nothing but a size header
+ * before each block to provide structure, so all that is displayed 
  * is a dump of the raw bytes. For a more structured allocator, you 
  * could implement dump_heap to instead just print the block headers, 
  * which would be less overwhelming to wade through for debugging.
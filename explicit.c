@@ -8,74 +8,472 @@
  * realloc.
  */
 
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include "./allocator.h"
 #include "./debug_break.h"
+#include "./segment.h"
+#ifdef THREADED
+#include <pthread.h>
+#endif
 
 // how many bytes are printed per line in dump_heap
 #define BYTES_PER_LINE 32
+#ifdef COMPACT_HEADERS
+// size of a header, which in the compact layout holds a 32-bit size
+#define HEADER_SIZE 4
+// minimum size of a payload, enough for the next/prev offsets and a footer
+#define PAYLOAD_MIN_SIZE 12
+// bytes at the start of a free block's payload holding its list or tree links
+#define NODE_SIZE 8
+#else
 // size of a header
 #define HEADER_SIZE 8
-// minimum size of a payload
-#define PAYLOAD_MIN_SIZE 16
+// minimum size of a payload, enough for the next/prev pointers and a footer
+#define PAYLOAD_MIN_SIZE 24
+// bytes at the start of a free block's payload holding its list or tree links
+#define NODE_SIZE 16
+#endif
+// alignment of every payload handed out; builds standing in for the system malloc
+// need 16, which keeps every block size 8 more than a multiple of 16
+#ifndef PAYLOAD_ALIGNMENT
+#define PAYLOAD_ALIGNMENT ALIGNMENT
+#endif
+// distance from the start of the heap to the first payload, and from the start of a
+// huge block's mapping to its payload; the header sits just before the payload
+#define PAYLOAD_OFFSET (PAYLOAD_ALIGNMENT > HEADER_SIZE ? PAYLOAD_ALIGNMENT : HEADER_SIZE)
 // total heap size
 #define HEAP_SIZE 4294967296
+// number of exact-size bins, each holding free blocks of one payload size
+#define NUM_EXACT_BINS 64
+// payload sizes below this limit are binned exactly, larger ones by power-of-two range
+#define EXACT_BIN_LIMIT (NUM_EXACT_BINS * ALIGNMENT)
+// log2 of EXACT_BIN_LIMIT, the first power-of-two range
+#define EXACT_BIN_LIMIT_LOG2 9
+// free blocks with at least this payload are kept in the best-fit tree; a power of two
+// no smaller than EXACT_BIN_LIMIT, with range bins covering any sizes in between
+#define TREE_MIN_SIZE 512
+// log2 of TREE_MIN_SIZE
+#define TREE_MIN_SIZE_LOG2 9
+// index of the pseudo-bin whose bitmap bit records that the tree is non-empty
+#define TREE_BIN (NUM_EXACT_BINS + TREE_MIN_SIZE_LOG2 - EXACT_BIN_LIMIT_LOG2)
+// total number of bins (exact bins, range bins, tree pseudo-bin), a multiple of 64
+#define NUM_BINS 128
+// number of 64-bit words in the non-empty bin bitmap
+#define BITMAP_WORDS (NUM_BINS / 64)
+// header bit set when the block is free
+#define FREE_BIT 1UL
+// header bit set when the block immediately to the left is free
+#define PREV_FREE_BIT 2UL
+// header bit set when a free block may have pages in its interior that are not committed
+#define DECOMMITTED_BIT 4UL
+// all header bits that are not part of the size
+#define FLAG_MASK 7UL
+// size and alignment of a slab page; a quarter of a VM page, so that classes with
+// only a few dozen live objects do not strand most of a 4K page
+#define SLAB_SIZE 1024
+// largest request served from a slab rather than a heap block
+#define SLAB_MAX_SIZE 48
+// live small heap blocks needed before slabs are used at all, so a heap with few
+// small objects does not pay for mostly-empty slab pages
+#define SLAB_MIN_LIVE 64
+// free blocks at least this large give the pages inside their payload back to the OS
+#define DECOMMIT_MIN_SIZE (64 * 1024)
+// calloc zeroes a recycled range at least this large by dropping its pages, not writing them
+#define ZERO_PAGES_MIN_SIZE (64 * 1024)
+// requests of at least this many bytes get a mapping of their own outside the heap
+// segment; override at build time with -DHUGE_MIN_SIZE=<bytes>
+#ifndef HUGE_MIN_SIZE
+#define HUGE_MIN_SIZE (128 * 1024)
+#endif
+// granularity of the mappings that hold huge blocks
+#define PAGE_SIZE 4096
+// bytes a huge block's mapping runs past the largest payload it can hold; with compact
+// headers payload sizes are 4 more than a multiple of 8, so the mapping has 4 to spare
+#define HUGE_TAIL (HEADER_SIZE % ALIGNMENT)
+// number of slab size classes, one per aligned slot size up to SLAB_MAX_SIZE
+#define NUM_SLAB_CLASSES (SLAB_MAX_SIZE / ALIGNMENT)
+// number of 64-bit words in a slab's slot bitmap, enough for the smallest slots
+#define SLAB_BITMAP_WORDS (SLAB_SIZE / ALIGNMENT / 64)
+// number of slab pages in the largest heap segment, one bit each in slab_pages
+#define HEAP_PAGES (HEAP_SIZE / SLAB_SIZE)
+// largest payload size kept in the per-thread caches (THREADED builds only)
+#define CACHE_MAX_SIZE 256
+// number of per-thread cache size classes, one per aligned payload size up to the block
+// size a CACHE_MAX_SIZE request rounds up to
+#define NUM_CACHE_CLASSES ((CACHE_MAX_SIZE + PAYLOAD_ALIGNMENT) / ALIGNMENT + 1)
+// most blocks a thread caches per size class before returning some to the heap
+#define CACHE_CLASS_LIMIT 64
 
-/* type block_header to denote an 8 byte block of memory containing the header
- * which stores the size of the block with the LSB indicating the status.
+/* type block_header to denote an 8 byte (4 with COMPACT_HEADERS) block of memory
+ * containing the header which stores the size of the block with the LSB indicating the status and
+ * the next bit indicating whether the left neighbor is free. A free block also
+ * repeats its size in a footer occupying the last HEADER_SIZE bytes of its payload,
+ * so its right neighbor can find it in O(1). Allocated blocks have no footer, and neither
+ * does the last block in the heap, which has no right neighbor to read it.
+ *
+ * The heap segment starts out reserved but not committed. Every header, every
+ * allocated payload, and the links and footer of every free block are always
+ * committed. Only the interior of a free block with DECOMMITTED_BIT set may have
+ * pages that are not, and those are committed again before the space is used.
+ *
+ * A huge block lives in a mapping of its own outside the heap segment, so it is
+ * recognized by its address alone. Its header sits just before the payload,
+ * which lies PAYLOAD_OFFSET bytes into the mapping, or for an aligned block at
+ * the first aligned address past that, with the whole pages in front of it
+ * unmapped. The header holds the payload size, which runs to the end of the
+ * mapping.
  */
+#ifdef COMPACT_HEADERS
+typedef uint32_t block_header;
+#else
 typedef size_t block_header;
+#endif
+
+/* A heap of at most HEAP_SIZE bytes lets COMPACT_HEADERS builds shrink the header to
+ * 4 bytes. Payload sizes are then 4 more than a multiple of ALIGNMENT, so the header
+ * stores the size plus HEADER_SIZE, the whole block, which leaves the flag bits
+ * clear. Default builds store the payload size as is.
+ */
+#ifdef COMPACT_HEADERS
+#define PACK_SIZE(size) ((size) + HEADER_SIZE)
+#define UNPACK_SIZE(field) ((field) - HEADER_SIZE)
+#else
+#define PACK_SIZE(size) (size)
+#define UNPACK_SIZE(field) (field)
+#endif
+
+/* type block_link to denote a free-list or tree link. In COMPACT_HEADERS builds it
+ * is the 32-bit offset of the linked payload from segment_start, which is never 0
+ * for a payload, so 0 stands for NULL; otherwise it is the pointer itself. Links are
+ * written with to_link and followed with NEXT, PREV, LEFT and RIGHT.
+ */
+#ifdef COMPACT_HEADERS
+typedef uint32_t block_link;
+#else
+typedef void *block_link;
+#endif
+#define NEXT(n) ((node_block *)from_link((n)->next))
+#define PREV(n) ((node_block *)from_link((n)->prev))
+#define LEFT(t) ((tree_block *)from_link((t)->left))
+#define RIGHT(t) ((tree_block *)from_link((t)->right))
 
 /* Struct: node_block
  * ------------------
  * This struct is used to denote a node, which in this case is defined 
- * to be the start of the payload. It holds two 8-byte pointers, next and prev,
- * used in the linked free-list traversal.
+ * to be the start of the payload. It holds two links, next and prev, used in the
+ * linked free-list traversal.
  */
 typedef struct node_block {
-    struct node_block *next;
-    struct node_block *prev;
+    block_link next;
+    block_link prev;
 } node_block;
 
+/* Struct: tree_block
+ * ------------------
+ * Free blocks of at least TREE_MIN_SIZE use the start of their payload as a node
+ * of a treap instead, holding the left and right child links. The treap is a
+ * binary search tree ordered by (size, address), so equal-size blocks are kept in
+ * address order, and a heap on a priority hashed from the block's address, which
+ * keeps its expected depth logarithmic without storing anything extra.
+ */
+typedef struct tree_block {
+    block_link left;
+    block_link right;
+} tree_block;
+
 static node_block *node;
 static void *segment_end;
 static void *segment_start;
-static node_block *list_front;
 static void *heap_end;
 
+/* Functions: to_link, from_link
+ * ------------------------------
+ * These functions convert a payload pointer, or NULL, to the block_link stored in
+ * a free block and back.
+ */
+block_link to_link(void *ptr) {
+#ifdef COMPACT_HEADERS
+    return ptr == NULL ? 0 : (block_link)((char *)ptr - (char *)segment_start);
+#else
+    return ptr;
+#endif
+}
+
+void *from_link(block_link link) {
+#ifdef COMPACT_HEADERS
+    return link == 0 ? NULL : (char *)segment_start + link;
+#else
+    return link;
+#endif
+}
+
+/* The free blocks are kept in an array of segregated doubly-linked lists. Bin i
+ * for i < NUM_EXACT_BINS holds blocks whose payload is exactly i * ALIGNMENT bytes,
+ * the next bins each hold a power-of-two range of payload sizes up to TREE_MIN_SIZE,
+ * and larger blocks live in the best-fit tree rooted at tree_root. Bit i of
+ * bin_bitmap is set whenever bin i is non-empty, so the first usable bin is found
+ * without walking empty lists.
+ */
+static node_block *bins[NUM_BINS];
+static uint64_t bin_bitmap[BITMAP_WORDS];
+static tree_block *tree_root;
+
+/* Struct: slab
+ * ------------
+ * Requests of up to SLAB_MAX_SIZE bytes are served from slabs: page-aligned
+ * heap blocks of one page carved into fixed-size slots with no per-slot header.
+ * This struct sits at the start of the slab's page, followed by the slots from
+ * the first aligned address after it (see slab_slots), and
+ * a set bit in used marks a slot in use (bits past the last slot are kept set).
+ * Slabs with a free slot are linked into the partial list for their class.
+ */
+typedef struct slab {
+    struct slab *next;
+    struct slab *prev;
+    size_t slot_size;
+    size_t nslots;
+    size_t nfree;
+    uint64_t used[SLAB_BITMAP_WORDS];
+} slab;
+
+/* A set bit in slab_pages marks a heap page that holds a slab, so free can tell
+ * a slot from a regular block by its page address in O(1). slab_page_limit is
+ * one past the highest page ever used for a slab, bounding what myinit clears.
+ */
+static slab *partial_slabs[NUM_SLAB_CLASSES];
+static uint64_t slab_pages[HEAP_PAGES / 64];
+static size_t slab_page_limit;
+
+/* Small requests are served from regular heap blocks until small_live, the number
+ * of small heap blocks currently live, first reaches SLAB_MIN_LIVE. From then on
+ * slabs_enabled stays set until the next myinit. A block counts as small by its
+ * size, no larger than a small request's block, when it is handed out and when it
+ * is given back, so every block counted is uncounted once.
+ */
+static size_t small_live;
+static bool slabs_enabled;
+
+/* The heap statistics are kept up to date as blocks change hands, so myheapstats
+ * is O(1). in_use counts the payload of every block handed out, a slab slot by its
+ * slot size, including blocks held in per-thread caches. add_node and remove_node
+ * keep the free totals, which leave out top_block, the free block running to the
+ * end of the segment. largest_free is the largest other free block, or NULL; it is
+ * found again in remove_node whenever it leaves the free lists.
+ */
+static size_t in_use;
+static size_t peak_in_use;
+static size_t free_bytes;
+static size_t free_count;
+static node_block *top_block;
+static node_block *largest_free;
+
+/* myinit starts the heap with every page decommitted, so it reads as zero until
+ * written. untouched is a high-water mark: no byte at or above it has been written
+ * since, so mycalloc need not zero that part of a block. take_block raises it past
+ * each block handed out and the links of any remainder split off after it, which
+ * is as far as the allocator itself writes. calloc_bytes and calloc_written count
+ * the bytes requested from mycalloc and how many of them it zeroed by writing.
+ */
+static char *untouched;
+static size_t calloc_bytes;
+static size_t calloc_written;
+
+#ifdef THREADED
+/* Struct: thread_cache
+ * --------------------
+ * In THREADED builds all of the state above is shared and guarded by heap_lock.
+ * Each thread also keeps a thread_cache of recently freed small blocks, one
+ * singly-linked list per size class threaded through the blocks' next pointers.
+ * Cached blocks stay marked used in the shared heap, so a malloc/free pair of a
+ * cached size never takes the lock. The generation detects caches that still
+ * hold blocks from before the heap was last re-initialized.
+ */
+typedef struct {
+    node_block *heads[NUM_CACHE_CLASSES];
+    size_t counts[NUM_CACHE_CLASSES];
+    unsigned long generation;
+    bool registered;
+} thread_cache;
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+static unsigned long heap_generation;
+static __thread thread_cache cache;
+
+#define LOCK_HEAP() pthread_mutex_lock(&heap_lock)
+#define UNLOCK_HEAP() pthread_mutex_unlock(&heap_lock)
+// a freeing thread reads its block's header and its page's slab_pages word without
+// the lock, while lock holders set bits in those words, so both sides use atomics
+#define SHARED_LOAD(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define SHARED_OR(p, bits) __atomic_fetch_or(p, bits, __ATOMIC_RELAXED)
+#define SHARED_AND(p, bits) __atomic_fetch_and(p, bits, __ATOMIC_RELAXED)
+
+const bool allocator_thread_safe = true;
+#else
+#define LOCK_HEAP()
+#define UNLOCK_HEAP()
+#define SHARED_LOAD(p) (*(p))
+#define SHARED_OR(p, bits) (*(p) |= (bits))
+#define SHARED_AND(p, bits) (*(p) &= (bits))
+
+const bool allocator_thread_safe = false;
+#endif
+
+void add_node(node_block *node_ptr);
+void find_largest_free(void);
+block_header *get_header(node_block *ptr);
+void set_free(node_block *ptr);
+bool can_coalesce(node_block *ptr);
+void coalesce(node_block *ptr);
+void *slab_alloc(size_t requested_size);
+size_t roundup(size_t sz, size_t mult);
+size_t fit_size(size_t span);
+void free_block(void *ptr);
+void free_heap_block(node_block *ptr);
+
 /* Function: myinit
  * ----------------
  * This function initializes the heap with the correct header size and
  * status as well as setting values for the static variable used later on. 
- * It also initializers the linked free-list and variable tracking the front 
- * of the list.
+ * It also empties every free-list bin and adds the single heap-sized block
+ * to the appropriate one. In THREADED builds it must not race with other
+ * allocator calls; it invalidates every thread's cache of the old heap.
  */
 bool myinit(void *heap_start, size_t heap_size) {
-    void *first = (char *)heap_start + HEADER_SIZE;
-    node = (node_block *)first;
-    node -> next = NULL;
-    node -> prev = NULL;   
-    list_front = node;
+    LOCK_HEAP();
+#ifdef THREADED
+    heap_generation++;
+#endif
+    if (heap_size > HEAP_SIZE) {
+        UNLOCK_HEAP();
+        return false;
+    }
+    memset(bins, 0, sizeof(bins));
+    memset(bin_bitmap, 0, sizeof(bin_bitmap));
+    tree_root = NULL;
+    memset(partial_slabs, 0, sizeof(partial_slabs));
+    memset(slab_pages, 0, roundup(slab_page_limit, 64) / 8);
+    slab_page_limit = 0;
+    small_live = 0;
+    slabs_enabled = false;
+    in_use = 0;
+    peak_in_use = 0;
+    free_bytes = 0;
+    free_count = 0;
+    top_block = NULL;
+    largest_free = NULL;
+    calloc_bytes = 0;
+    calloc_written = 0;
 
     segment_start = heap_start;
     segment_end = heap_start;
-    // initialize size of block
-    *(block_header *)heap_start = (heap_size - HEADER_SIZE);
-    // initialize status to free
-    *(block_header *)heap_start |= 1UL; 
-    heap_end = (char *)heap_start + heap_size;
+    size_t first_size = fit_size(heap_size - PAYLOAD_OFFSET);
+    heap_end = (char *)heap_start + PAYLOAD_OFFSET + first_size;
+
+    void *first = (char *)heap_start + PAYLOAD_OFFSET;
+    node = (node_block *)first;
+    // give back any pages of an earlier heap, so the new one starts out zero-filled
+    if (!segment_decommit(heap_start, heap_size) || 
+        !segment_commit(heap_start, PAYLOAD_OFFSET + NODE_SIZE)) {
+        UNLOCK_HEAP();
+        return false;
+    }
+    untouched = (char *)first + NODE_SIZE;
+    // initialize size of block with only its pages uncommitted, then mark it free
+    *get_header(node) = PACK_SIZE(first_size) | DECOMMITTED_BIT;
+    set_free(node);
+    add_node(node);
+    UNLOCK_HEAP();
 
     return true;
 }
 /* Function: get_block_size
  * ------------------------
  * This function returns the size of the block by temporarily turning off the 
- * LSB of the current header.
+ * flag bits of the current header.
  */
 size_t get_block_size(node_block *ptr) {
-    return *(block_header *)((char *)ptr - HEADER_SIZE) & ~1UL;
+    return UNPACK_SIZE(SHARED_LOAD(get_header(ptr)) & ~FLAG_MASK);
+}
+
+/* Function: get_header
+ * --------------------
+ * This function returns a pointer to the header of the block with the given payload.
+ */
+block_header *get_header(node_block *ptr) {
+    return (block_header *)((char *)ptr - HEADER_SIZE);
+}
+
+/* Function: right_neighbor
+ * ------------------------
+ * This function returns the payload of the block adjacent to the right of the given
+ * block, or NULL if the given block is the last one in the heap.
+ */
+node_block *right_neighbor(node_block *ptr) {
+    void *right_header = (char *)ptr + get_block_size(ptr);
+    if (right_header == heap_end) {
+        return NULL;
+    }
+    return (node_block *)((char *)right_header + HEADER_SIZE);
+}
+
+/* Function: left_neighbor
+ * -----------------------
+ * This function returns the payload of the block adjacent to the left of the given
+ * block if that block is free, or NULL otherwise. The left block's footer sits just
+ * before the given block's header and records its size.
+ */
+node_block *left_neighbor(node_block *ptr) {
+    block_header *header = get_header(ptr);
+    if ((*header & PREV_FREE_BIT) == 0) {
+        return NULL;
+    }
+    size_t left_size = UNPACK_SIZE(*(header - 1) & ~FLAG_MASK);
+    return (node_block *)((char *)header - left_size);
+}
+
+/* Function: set_free
+ * ------------------
+ * This function marks the block free, writes its footer and tells its right neighbor
+ * that its left neighbor is now free. The block's own size must already be set.
+ */
+void set_free(node_block *ptr) {
+    size_t size = get_block_size(ptr);
+    *get_header(ptr) |= FREE_BIT;
+    node_block *right = right_neighbor(ptr);
+    if (right != NULL) {
+        *(block_header *)((char *)ptr + size - HEADER_SIZE) = PACK_SIZE(size);
+        SHARED_OR(get_header(right), PREV_FREE_BIT);
+    }
+}
+
+/* Function: set_used
+ * ------------------
+ * This function marks the block used and tells its right neighbor that its left
+ * neighbor is no longer free. The block's own size must already be set.
+ */
+void set_used(node_block *ptr) {
+    *get_header(ptr) &= ~FREE_BIT;
+    node_block *right = right_neighbor(ptr);
+    if (right != NULL) {
+        SHARED_AND(get_header(right), ~PREV_FREE_BIT);
+    }
+}
+
+/* Function: set_block_size
+ * ------------------------
+ * This function updates the size recorded in a block's header, keeping its flags.
+ */
+void set_block_size(node_block *ptr, size_t size) {
+    block_header *header = get_header(ptr);
+    *header = (*header & FLAG_MASK) | PACK_SIZE(size);
 }
 
 /* Function: roundup
@@ -87,6 +485,26 @@ size_t roundup(size_t sz, size_t mult) {
     return (sz + mult - 1) & ~(mult - 1);
 }
 
+/* Function: adjust_size
+ * ---------------------
+ * This function returns the payload size used to satisfy a request of the given
+ * size: the request rounded up so the next block's payload is aligned too, and at
+ * least the minimum payload.
+ */
+size_t adjust_size(size_t requested_size) {
+    size_t needed = roundup(requested_size + HEADER_SIZE, PAYLOAD_ALIGNMENT) - HEADER_SIZE;
+    return needed < PAYLOAD_MIN_SIZE ? PAYLOAD_MIN_SIZE : needed;
+}
+
+/* Function: fit_size
+ * ------------------
+ * This function returns the largest payload size whose block fits in the given
+ * number of bytes from the payload on, and whose end is where a header could follow.
+ */
+size_t fit_size(size_t span) {
+    return (span + HEADER_SIZE) / ALIGNMENT * ALIGNMENT - HEADER_SIZE;
+}
+
 /* Function: dump_heap
  * -------------------
  * This function is a debugging tool. It prints out useful information about the 
@@ -95,60 +513,342 @@ size_t roundup(size_t sz, size_t mult) {
  */
 void dump_heap(node_block *ptr, size_t requested_size) {
   
-    size_t needed = requested_size <= ALIGNMENT ?
-        PAYLOAD_MIN_SIZE : roundup(requested_size, ALIGNMENT);
+    size_t needed = adjust_size(requested_size);
     size_t header_size = get_block_size(ptr);
     void *new_node_temp = (char *)ptr + needed + HEADER_SIZE;
     node_block *new_node = (node_block *)new_node_temp;
     printf("Address: %p Payload size: %zu New Node Next: %p New Node Prev: %p\n",
-    ptr, header_size, new_node->next, new_node->prev);
+    ptr, header_size, (void *)NEXT(new_node), (void *)PREV(new_node));
+}
+
+/* Function: bin_index
+ * -------------------
+ * This function returns the index of the bin that holds free blocks of the given
+ * payload size. Small sizes map to their own exact bin, medium sizes map to the
+ * bin for their power-of-two range and large sizes map to the tree pseudo-bin.
+ */
+size_t bin_index(size_t size) {
+    if (size < EXACT_BIN_LIMIT) {
+        return size / ALIGNMENT;
+    }
+    if (size >= TREE_MIN_SIZE) {
+        return TREE_BIN;
+    }
+    size_t log2 = 63 - __builtin_clzl(size);
+    return NUM_EXACT_BINS + log2 - EXACT_BIN_LIMIT_LOG2;
+}
+
+/* Function: next_nonempty_bin
+ * ---------------------------
+ * This function uses the bin bitmap to find the first non-empty bin with index
+ * at least start. It returns NUM_BINS if every such bin is empty.
+ */
+size_t next_nonempty_bin(size_t start) {
+    if (start >= NUM_BINS) {
+        return NUM_BINS;
+    }
+    size_t word = start / 64;
+    uint64_t bits = bin_bitmap[word] & (~0UL << (start % 64));
+    while (bits == 0) {
+        if (++word == BITMAP_WORDS) {
+            return NUM_BINS;
+        }
+        bits = bin_bitmap[word];
+    }
+    return word * 64 + __builtin_ctzl(bits);
+}
+
+/* Function: tree_priority
+ * -----------------------
+ * This function returns the treap priority of a node, a multiplicative hash of its
+ * address, so priorities are effectively random but need no storage.
+ */
+uint64_t tree_priority(tree_block *t) {
+    return ((uintptr_t)t >> 3) * 0x9E3779B97F4A7C15UL;
+}
+
+/* Function: tree_less
+ * -------------------
+ * This function returns true if block a orders before block b in the tree, comparing
+ * sizes first and addresses second.
+ */
+bool tree_less(tree_block *a, tree_block *b) {
+    size_t a_size = get_block_size((node_block *)a);
+    size_t b_size = get_block_size((node_block *)b);
+    return a_size < b_size || (a_size == b_size && a < b);
+}
+
+/* Function: tree_insert
+ * ---------------------
+ * This function inserts node t into the subtree with the given root as a leaf, then
+ * rotates it up while its priority beats its parent's. Returns the new subtree root.
+ */
+tree_block *tree_insert(tree_block *root, tree_block *t) {
+    if (root == NULL) {
+        t->left = to_link(NULL);
+        t->right = to_link(NULL);
+        return t;
+    }
+    if (tree_less(t, root)) {
+        tree_block *child = tree_insert(LEFT(root), t);
+        root->left = to_link(child);
+        if (tree_priority(child) > tree_priority(root)) {
+            // rotate right
+            root->left = child->right;
+            child->right = to_link(root);
+            return child;
+        }
+    } else {
+        tree_block *child = tree_insert(RIGHT(root), t);
+        root->right = to_link(child);
+        if (tree_priority(child) > tree_priority(root)) {
+            // rotate left
+            root->right = child->left;
+            child->left = to_link(root);
+            return child;
+        }
+    }
+    return root;
+}
+
+/* Function: tree_merge
+ * --------------------
+ * This function joins two treaps where every node of a orders before every node of b,
+ * keeping the higher-priority root on top. Returns the root of the joined treap.
+ */
+tree_block *tree_merge(tree_block *a, tree_block *b) {
+    if (a == NULL) {
+        return b;
+    }
+    if (b == NULL) {
+        return a;
+    }
+    if (tree_priority(a) > tree_priority(b)) {
+        a->right = to_link(tree_merge(RIGHT(a), b));
+        return a;
+    }
+    b->left = to_link(tree_merge(a, LEFT(b)));
+    return b;
+}
+
+/* Function: tree_remove
+ * ---------------------
+ * This function finds node t by its (size, address) key and replaces it with the
+ * merge of its children. Returns the new subtree root.
+ */
+tree_block *tree_remove(tree_block *root, tree_block *t) {
+    if (root == t) {
+        return tree_merge(LEFT(t), RIGHT(t));
+    }
+    if (tree_less(t, root)) {
+        root->left = to_link(tree_remove(LEFT(root), t));
+    } else {
+        root->right = to_link(tree_remove(RIGHT(root), t));
+    }
+    return root;
+}
+
+/* Function: tree_best_fit
+ * -----------------------
+ * This function returns the smallest tree block with payload of at least needed
+ * bytes, preferring the lowest address among equal sizes, or NULL if none fits.
+ */
+tree_block *tree_best_fit(size_t needed) {
+    tree_block *best = NULL;
+    tree_block *cur = tree_root;
+    while (cur != NULL) {
+        if (get_block_size((node_block *)cur) >= needed) {
+            best = cur;
+            cur = LEFT(cur);
+        } else {
+            cur = RIGHT(cur);
+        }
+    }
+    return best;
 }
 
 /* Function: add_node
  * ------------------
- * This function adds a node to the linked free-list. If there are nodes in the
- * list, it initializes a node. Otherwise, it adds the node to the front of the list
- * and updates the list_front vraiable to reflect the newly added node.
+ * This function adds a node to the front of the free-list bin matching its block
+ * size, or to the best-fit tree if it is large, so the header size must be set
+ * before calling. It marks the bin as non-empty in the bitmap and adds the block to
+ * the free totals, unless it is the top block.
  */
 void add_node(node_block *node_ptr) {
-    if (list_front == NULL) {
-        node_ptr->next = NULL;
-        node_ptr->prev = NULL;
+    size_t size = get_block_size(node_ptr);
+    if (right_neighbor(node_ptr) == NULL) {
+        top_block = node_ptr;
+    } else {
+        free_bytes += size;
+        free_count++;
+        if (largest_free == NULL || size > get_block_size(largest_free)) {
+            largest_free = node_ptr;
+        }
+    }
+    size_t index = bin_index(size);
+    if (index == TREE_BIN) {
+        tree_root = tree_insert(tree_root, (tree_block *)node_ptr);
+        bin_bitmap[index / 64] |= 1UL << (index % 64);
+        return;
     }
-    else {
-        node_ptr->next = list_front;
-        node_ptr->next->prev = node_ptr;
-        node_ptr->prev = NULL;
+    node_ptr->next = to_link(bins[index]);
+    node_ptr->prev = to_link(NULL);
+    if (bins[index] != NULL) {
+        bins[index]->prev = to_link(node_ptr);
     }
-    list_front = node_ptr;
+    bins[index] = node_ptr;
+    bin_bitmap[index / 64] |= 1UL << (index % 64);
 }
 
 /* Function: remove_node
  * ---------------------
- * This function removes a node from the linked free-list. It accounts for special cases
- * where the node may be the head of the list, end of the list, or the only element in
- * the list.
+ * This function removes a node from its free-list bin or the best-fit tree. It must
+ * be called before the block's header size changes, since the size determines the
+ * bin and the node's place in the tree. If the bin becomes empty, its bit is
+ * cleared from the bitmap. The block is taken out of the free totals too.
  */
 void remove_node(node_block *node_ptr) {   
-    // only node in list
-    if (node_ptr->next == NULL && node_ptr->prev == NULL) {
-        list_front = NULL;
+    size_t size = get_block_size(node_ptr);
+    if (size >= TREE_MIN_SIZE) {
+        tree_root = tree_remove(tree_root, (tree_block *)node_ptr);
+        if (tree_root == NULL) {
+            bin_bitmap[TREE_BIN / 64] &= ~(1UL << (TREE_BIN % 64));
+        }
+    } else {
+        node_block *prev = PREV(node_ptr);
+        node_block *next = NEXT(node_ptr);
+        if (prev != NULL) {
+            prev->next = node_ptr->next;
+        } else {
+            size_t index = bin_index(size);
+            bins[index] = next;
+            if (bins[index] == NULL) {
+                bin_bitmap[index / 64] &= ~(1UL << (index % 64));
+            }
+        }
+        if (next != NULL) {
+            next->prev = node_ptr->prev;
+        }
+        node_ptr->next = to_link(NULL);
+        node_ptr->prev = to_link(NULL);
     }
-    // head of list
-    else if (node_ptr->next != NULL && node_ptr->prev == NULL) {
-        node_ptr->next->prev = NULL;
-        list_front = node_ptr->next;
-    }     
-    // end of list
-    else if (node_ptr->prev != NULL && node_ptr->next == NULL) {
-        node_ptr->prev->next = NULL;
+    if (node_ptr == top_block) {
+        top_block = NULL;
+    } else {
+        free_bytes -= size;
+        free_count--;
+        if (node_ptr == largest_free) {
+            find_largest_free();
+        }
+    }
+}
+
+/* Function: find_largest_free
+ * ---------------------------
+ * This function finds the largest free block other than the top block, after the
+ * previous one left the free lists. The largest tree block ends the tree's right
+ * spine, and if that is the top block the next largest is its predecessor, so this
+ * takes no longer than the tree removal before it. With no other tree blocks, the
+ * highest non-empty bin holds the largest block.
+ */
+void find_largest_free(void) {
+    tree_block *parent = NULL;
+    tree_block *max = tree_root;
+    while (max != NULL && RIGHT(max) != NULL) {
+        parent = max;
+        max = RIGHT(max);
+    }
+    if (max != NULL && (node_block *)max == top_block) {
+        if (LEFT(max) != NULL) {
+            max = LEFT(max);
+            while (RIGHT(max) != NULL) {
+                max = RIGHT(max);
+            }
+        } else {
+            max = parent;
+        }
     }
-    else {
-        node_ptr->prev->next = node_ptr->next;
-        node_ptr->next->prev = node_ptr->prev;        
+    largest_free = (node_block *)max;
+    for (size_t index = TREE_BIN; largest_free == NULL && index-- > 0; ) {
+        if (bin_bitmap[index / 64] & (1UL << (index % 64))) {
+            // exact bins hold one size, so only range bins need a full scan
+            for (node_block *cur = bins[index]; cur != NULL; cur = NEXT(cur)) {
+                if (cur != top_block && (largest_free == NULL || 
+                    get_block_size(cur) > get_block_size(largest_free))) {
+                    largest_free = cur;
+                    if (index < NUM_EXACT_BINS) {
+                        break;
+                    }
+                }
+            }
+        }
     }
-    node_ptr->next = NULL;
-    node_ptr->prev = NULL;
+}
+
+/* Function: track_in_use
+ * ----------------------
+ * This function updates in_use for blocks handed out and given back, of added and
+ * removed payload bytes, and raises the high-water mark if it was passed.
+ */
+void track_in_use(size_t added, size_t removed) {
+    in_use = in_use + added - removed;
+    if (in_use > peak_in_use) {
+        peak_in_use = in_use;
+    }
+}
+
+/* Function: is_small_block
+ * ------------------------
+ * This function returns whether a heap block of the given payload size counts
+ * towards small_live: whether it is no larger than a block for a small request.
+ */
+bool is_small_block(size_t block_size) {
+    return block_size <= adjust_size(SLAB_MAX_SIZE);
+}
+
+/* Functions: count_small, uncount_small
+ * -------------------------------------
+ * These functions update small_live for a heap block of the given payload size
+ * handed out or given back while slabs are off, if it is small. count_small turns
+ * slabs on once SLAB_MIN_LIVE small blocks are live.
+ */
+void count_small(size_t block_size) {
+    if (!slabs_enabled && is_small_block(block_size) && ++small_live >= SLAB_MIN_LIVE) {
+        slabs_enabled = true;
+    }
+}
+
+void uncount_small(size_t block_size) {
+    if (!slabs_enabled && small_live > 0 && is_small_block(block_size)) {
+        small_live--;
+    }
+}
+
+/* Function: find_fit
+ * ------------------
+ * This function returns a free block with payload of at least needed bytes, or NULL
+ * if there is none. Range bins hold mixed sizes, so the request's own range bin is
+ * searched first-fit; any block in a later non-empty bin is guaranteed to fit. Large
+ * requests, or requests that only the tree can satisfy, get the tree's best fit.
+ */
+node_block *find_fit(size_t needed) {
+    size_t index = bin_index(needed);
+    if (index == TREE_BIN) {
+        return (node_block *)tree_best_fit(needed);
+    }
+    if (index >= NUM_EXACT_BINS) {
+        for (node_block *cur = bins[index]; cur != NULL; cur = NEXT(cur)) {
+            if (get_block_size(cur) >= needed) {
+                return cur;
+            }
+        }
+        index++;
+    }
+    index = next_nonempty_bin(index);
+    if (index == TREE_BIN) {
+        return (node_block *)tree_best_fit(needed);
+    }
+    return index < NUM_BINS ? bins[index] : NULL;
 }
 
 /* Function: is_free
@@ -156,79 +856,440 @@ void remove_node(node_block *node_ptr) {
  * This function return true if the current block is free and false if it is used.
  */
 bool is_free(block_header *header) {
-    return (*header & 1UL) == 1 ? true : false;
+    return (*header & FREE_BIT) != 0;
 }
 
 /* Function: split_block
  * ---------------------
- * This function splits the block at the needed size. It updates the headers of the
- * newly split blocks to reflect the changes. 
+ * This function splits the used block at the needed payload size. It updates the
+ * headers of the newly split blocks to reflect the changes, merges the free remainder
+ * with its right neighbor if that is also free, and adds the remainder to its bin.
+ * The remainder inherits the block's DECOMMITTED_BIT. The block being split must
+ * not be on a free-list.
  */
-void split_block(node_block *ptr, size_t size) {
-    size_t needed = size <= ALIGNMENT ?
-        PAYLOAD_MIN_SIZE : roundup(size, ALIGNMENT);
-    
+void split_block(node_block *ptr, size_t needed) {
+    size_t remaining = get_block_size(ptr) - needed - HEADER_SIZE;
+    block_header decommitted = *get_header(ptr) & DECOMMITTED_BIT;
+    set_block_size(ptr, needed);
+    *get_header(ptr) &= ~DECOMMITTED_BIT;
+
     segment_end = (char *)ptr + needed;
-    
-    // initialize size of new header
-    *(block_header *)segment_end = (get_block_size(ptr) - needed - HEADER_SIZE);
-    // initialize status of new header to free
-    *(block_header *)segment_end |= 1UL;
+    node_block *new_node = (node_block *)((char *)segment_end + HEADER_SIZE);
+    // initialize size of new header, its left neighbor is the used block
+    *(block_header *)segment_end = PACK_SIZE(remaining) | decommitted;
+    if (can_coalesce(new_node)) {
+        coalesce(new_node);
+    }
+    set_free(new_node);
+    add_node(new_node);
+}
 
-    // update curr header size 
-    void *curr_header = (char *)ptr - HEADER_SIZE;
-    *(block_header *)curr_header = needed;
-    // update curr header status to used
-    *(block_header *)curr_header &= ~1UL;
+/* Function: commit_block
+ * -----------------------
+ * This function commits the part of a block that is about to hold needed bytes of
+ * payload, plus the header and links of the remainder that may be split off after
+ * it, if the block might have decommitted pages. It returns false if the memory
+ * could not be committed.
+ */
+bool commit_block(node_block *ptr, size_t needed) {
+    if ((*get_header(ptr) & DECOMMITTED_BIT) == 0) {
+        return true;
+    }
+    size_t size = get_block_size(ptr);
+    size_t len = needed + HEADER_SIZE + NODE_SIZE;
+    return segment_commit(ptr, len < size ? len : size);
 }
 
-/* Function: mymalloc
+/* Function: take_block
+ * --------------------
+ * This function turns a block that is not on a free-list into a used block of the
+ * needed payload size: it marks the block used and splits off any excess as a new
+ * free block. The space must already have been committed with commit_block. The
+ * high-water mark moves past the block and the remainder's header and links.
+ */
+void take_block(node_block *ptr, size_t needed) {
+    set_used(ptr);
+    // if we should split, split
+    if (get_block_size(ptr) - needed >= HEADER_SIZE + PAYLOAD_MIN_SIZE) {
+        split_block(ptr, needed);
+    }
+    *get_header(ptr) &= ~DECOMMITTED_BIT;
+    char *written = (char *)ptr + get_block_size(ptr) + HEADER_SIZE + NODE_SIZE;
+    if (written > untouched) {
+        untouched = written;
+    }
+}
+
+/* Function: zero_range
+ * ---------------------
+ * This function zeroes the committed heap bytes [start, end) and returns how many
+ * of them it wrote to. A range of at least ZERO_PAGES_MIN_SIZE has its whole pages
+ * dropped with segment_zero instead, leaving only the partial pages at its ends to
+ * be written.
+ */
+size_t zero_range(char *start, char *end) {
+    if (end - start >= ZERO_PAGES_MIN_SIZE) {
+        char *pages_start = (char *)roundup((uintptr_t)start, PAGE_SIZE);
+        char *pages_end = (char *)((uintptr_t)end & ~(uintptr_t)(PAGE_SIZE - 1));
+        if (segment_zero(start, end - start)) {
+            memset(start, 0, pages_start - start);
+            memset(pages_end, 0, end - pages_end);
+            return (pages_start - start) + (end - pages_end);
+        }
+    }
+    memset(start, 0, end - start);
+    return end - start;
+}
+
+/* Function: is_huge
+ * -----------------
+ * This function returns whether the given payload is a huge block, which is the
+ * case exactly when it lies outside the heap segment.
+ */
+bool is_huge(void *ptr) {
+    return (char *)ptr < (char *)segment_start || (char *)ptr >= (char *)heap_end;
+}
+
+/* Function: huge_mapping
+ * ----------------------
+ * This function returns the start of a huge block's mapping, the page holding the
+ * point PAYLOAD_OFFSET bytes before its payload.
+ */
+char *huge_mapping(void *ptr) {
+    return (char *)(((uintptr_t)ptr - PAYLOAD_OFFSET) & ~(uintptr_t)(PAGE_SIZE - 1));
+}
+
+/* Function: huge_length
+ * ---------------------
+ * This function returns the length of the mapping a huge block with the given payload
+ * and payload size needs: from the start of its mapping to the end of the page its
+ * payload, and the HUGE_TAIL after it, end in.
+ */
+size_t huge_length(void *ptr, size_t size) {
+    return roundup((uintptr_t)ptr + size + HUGE_TAIL, PAGE_SIZE) - (uintptr_t)huge_mapping(ptr);
+}
+
+/* Function: huge_alloc
+ * --------------------
+ * This function maps a fresh region for the header and the requested payload at the
+ * given alignment and returns its payload. An alignment beyond PAYLOAD_OFFSET is
+ * met by mapping that much more and unmapping the whole pages left over on either
+ * side, so the mapping is again just large enough, rounded up to whole pages.
+ * Returns NULL if the OS refused the mapping.
+ */
+void *huge_alloc(size_t requested_size, size_t alignment) {
+    size_t extra = alignment > PAYLOAD_OFFSET ? alignment : 0;
+    size_t len = roundup(requested_size + PAYLOAD_OFFSET + HUGE_TAIL + extra, PAGE_SIZE);
+    char *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    node_block *ptr = (node_block *)roundup((uintptr_t)map + PAYLOAD_OFFSET, alignment);
+    char *start = huge_mapping(ptr);
+    char *end = start + huge_length(ptr, requested_size);
+    if (start > map) {
+        munmap(map, start - map);
+    }
+    if (end < map + len) {
+        munmap(end, map + len - end);
+    }
+    *get_header(ptr) = PACK_SIZE(fit_size(end - (char *)ptr));
+    return ptr;
+}
+
+/* Function: huge_free
  * -------------------
- * This function completes the client's allocation request. It searches the linked free-list
- * for a free block of viable size and returns the pointer to the location at which the 
- * client's request should be allocated. It then splits the block if possible to accomodate
- * following requests. It removes the newly allocated node from the free-list and adds the
- * free split portion to the list.
+ * This function unmaps a huge block, returning its memory to the OS at once.
  */
-void *mymalloc(size_t requested_size) {
+void huge_free(void *ptr) {
+    munmap(huge_mapping(ptr), huge_length(ptr, get_block_size(ptr)));
+}
+
+/* Function: huge_realloc
+ * ----------------------
+ * This function resizes a huge block's mapping with mremap, which moves the pages
+ * rather than copying them if the mapping cannot grow where it is. Returns NULL,
+ * leaving the block as it was, if the OS refused.
+ */
+void *huge_realloc(void *ptr, size_t new_size) {
+    char *start = huge_mapping(ptr);
+    size_t old_len = huge_length(ptr, get_block_size(ptr));
+    size_t new_len = huge_length(ptr, new_size);
+    if (new_len == old_len) {
+        return ptr;
+    }
+    char *map = mremap(start, old_len, new_len, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    // the payload keeps its offset into the mapping, and so its alignment up to a page
+    ptr = map + ((char *)ptr - start);
+    *get_header(ptr) = PACK_SIZE(fit_size(map + new_len - (char *)ptr));
+    return ptr;
+}
+
+/* Function: malloc_block
+ * -----------------------
+ * This function completes the client's allocation request. Huge requests get a
+ * mapping of their own, and small requests are served from a slab when possible. Otherwise it looks up the first free-list bin
+ * that can hold the request and takes a viable block from it, then removes that
+ * block from its bin. It splits the block if possible to accomodate following
+ * requests, which adds the free split portion back to the bins.
+ */
+void *malloc_block(size_t requested_size) {
     if ((requested_size > MAX_REQUEST_SIZE) || (requested_size == 0)) {
         return NULL;
     }    
-    size_t needed = requested_size <= ALIGNMENT ?
-        PAYLOAD_MIN_SIZE : roundup(requested_size, ALIGNMENT);
+    if (requested_size >= HUGE_MIN_SIZE) {
+        void *ptr = huge_alloc(requested_size, PAYLOAD_ALIGNMENT);
+        if (ptr != NULL) {
+            track_in_use(get_block_size(ptr), 0);
+        }
+        return ptr;
+    }
+    if (requested_size <= SLAB_MAX_SIZE && slabs_enabled) {
+        void *slot = slab_alloc(requested_size);
+        if (slot != NULL) {
+            track_in_use(roundup(requested_size, PAYLOAD_ALIGNMENT), 0);
+            return slot;
+        }
+    }
+    size_t needed = adjust_size(requested_size);
     
-    node = list_front;
-    while (node != NULL) {
-        size_t block_size = get_block_size(node);
-        // if found viable block
-        if (block_size >= needed) {
-            node_block *curr_node = node;
-            // if we should split, split
-            if (block_size - needed >= HEADER_SIZE + PAYLOAD_MIN_SIZE) {
-                split_block(node, requested_size);
-                
-                // remove current node from free list
-                remove_node(node);
-                
-                // make new node
-                void *temp_node = ((char *)segment_end + HEADER_SIZE);
-                node_block *new_node = (node_block *)temp_node;
-                
-                // add new node to free list
-                add_node(new_node);
-                
-                // dump_heap(curr_node, requested_size);               
-            } else {
-                // update current header to used
-                *(block_header *)((char *)node - HEADER_SIZE) &= ~1;
-                remove_node(node);
-            }
-            return curr_node;
+    node = find_fit(needed);
+    if (node == NULL) {
+        fprintf(stderr, "Heap space exhausted.\n");
+        return NULL;
+    }
+    if (!commit_block(node, needed)) {
+        fprintf(stderr, "Heap memory could not be committed.\n");
+        return NULL;
+    }
+    remove_node(node);
+    take_block(node, needed);
+    track_in_use(get_block_size(node), 0);
+    count_small(get_block_size(node));
+    // dump_heap(node, requested_size);
+    return node;
+}
+
+/* Function: carve_aligned
+ * ------------------------
+ * This function allocates a used block whose payload of at least needed bytes starts
+ * at a multiple of alignment, which must be a power of 2 no smaller than a minimum
+ * block. The slack in front of the aligned payload is split off as its own free block,
+ * or skipped over by another alignment step if it is too small to hold one. Returns
+ * NULL if no free block is large enough.
+ */
+node_block *carve_aligned(size_t alignment, size_t needed) {
+    node_block *ptr = find_fit(needed + alignment + HEADER_SIZE + PAYLOAD_MIN_SIZE);
+    if (ptr == NULL) {
+        return NULL;
+    }
+    size_t block_size = get_block_size(ptr);
+    char *aligned = (char *)roundup((uintptr_t)ptr, alignment);
+    if (aligned != (char *)ptr && aligned - (char *)ptr < HEADER_SIZE + PAYLOAD_MIN_SIZE) {
+        aligned += alignment;
+    }
+    // commit from the slack's footer through the aligned block and any remainder links
+    block_header decommitted = *get_header(ptr) & DECOMMITTED_BIT;
+    if (decommitted && !segment_commit(aligned - 2 * HEADER_SIZE, 
+        needed + 3 * HEADER_SIZE + NODE_SIZE)) {
+        return NULL;
+    }
+    remove_node(ptr);
+    if (aligned != (char *)ptr) {
+        // the aligned block keeps the rest, the leading slack stays free
+        size_t slack = aligned - (char *)ptr;
+        *get_header((node_block *)aligned) = PACK_SIZE(block_size - slack) | decommitted;
+        set_block_size(ptr, slack - HEADER_SIZE);
+        set_free(ptr);
+        add_node(ptr);
+        ptr = (node_block *)aligned;
+    }
+    take_block(ptr, needed);
+    return ptr;
+}
+
+/* Function: carve_batch
+ * ----------------------
+ * This function hands out up to n used blocks of needed payload bytes, laid end to
+ * end in a single free block, and stores them in out. It takes the free block a
+ * single malloc would, so a batch reuses freed space just as well, carves as many
+ * of the blocks from it as it holds, and splits it once for the whole run before
+ * writing the headers inside it. The last block keeps any excess too small to split
+ * off. The blocks are counted as in use. Returns how many blocks it carved, 0 if no
+ * free block holds even one.
+ */
+size_t carve_batch(size_t needed, size_t n, void *out[]) {
+    node_block *ptr = find_fit(needed);
+    if (ptr == NULL) {
+        return 0;
+    }
+    size_t stride = needed + HEADER_SIZE;
+    size_t count = (get_block_size(ptr) + HEADER_SIZE) / stride;
+    count = count < n ? count : n;
+    size_t run = count * stride - HEADER_SIZE;
+    if (!commit_block(ptr, run)) {
+        return 0;
+    }
+    remove_node(ptr);
+    take_block(ptr, run);
+    // the run is a used block now; give each block in it a used header of its own
+    size_t total = get_block_size(ptr);
+    out[0] = ptr;
+    for (size_t i = 1; i < count; i++) {
+        out[i] = (char *)ptr + i * stride;
+        *get_header(out[i]) = PACK_SIZE(needed);
+    }
+    if (count > 1) {
+        set_block_size(ptr, needed);
+        *get_header(out[count - 1]) = PACK_SIZE(total - (count - 1) * stride);
+    }
+    for (size_t i = 0; i < count; i++) {
+        count_small(get_block_size(out[i]));
+    }
+    track_in_use(total - (count - 1) * HEADER_SIZE, 0);
+    return count;
+}
+
+/* Function: find_slab
+ * -------------------
+ * This function returns the slab holding the given pointer, or NULL if the pointer
+ * is a regular heap block. The slab's metadata lives at the start of its page.
+ */
+slab *find_slab(void *ptr) {
+    size_t page = ((char *)ptr - (char *)segment_start) / SLAB_SIZE;
+    if ((SHARED_LOAD(&slab_pages[page / 64]) & (1UL << (page % 64))) == 0) {
+        return NULL;
+    }
+    return (slab *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+/* Function: slab_slots
+ * --------------------
+ * This function returns the address of a slab's first slot, the first payload-aligned
+ * address after the slab struct.
+ */
+char *slab_slots(slab *s) {
+    return (char *)s + roundup(sizeof(slab), PAYLOAD_ALIGNMENT);
+}
+
+/* Function: new_slab
+ * ------------------
+ * This function carves a page-aligned block out of the heap, formats it as an empty
+ * slab of the given slot size and pushes it on its class's partial list. The block
+ * payload ends HEADER_SIZE short of the page so the next block's header fits.
+ */
+slab *new_slab(size_t slot_size) {
+    slab *s = (slab *)carve_aligned(SLAB_SIZE, SLAB_SIZE - HEADER_SIZE);
+    if (s == NULL) {
+        return NULL;
+    }
+    s->slot_size = slot_size;
+    s->nslots = ((char *)s + SLAB_SIZE - HEADER_SIZE - slab_slots(s)) / slot_size;
+    s->nfree = s->nslots;
+    memset(s->used, 0xff, sizeof(s->used));
+    for (size_t i = 0; i < s->nslots; i++) {
+        s->used[i / 64] &= ~(1UL << (i % 64));
+    }
+
+    size_t index = slot_size / ALIGNMENT - 1;
+    s->prev = NULL;
+    s->next = partial_slabs[index];
+    if (s->next != NULL) {
+        s->next->prev = s;
+    }
+    partial_slabs[index] = s;
+
+    size_t page = ((char *)s - (char *)segment_start) / SLAB_SIZE;
+    SHARED_OR(&slab_pages[page / 64], 1UL << (page % 64));
+    if (page >= slab_page_limit) {
+        slab_page_limit = page + 1;
+    }
+    return s;
+}
+
+/* Function: unlink_slab
+ * ---------------------
+ * This function removes a slab from its class's partial list.
+ */
+void unlink_slab(slab *s) {
+    size_t index = s->slot_size / ALIGNMENT - 1;
+    if (s->prev != NULL) {
+        s->prev->next = s->next;
+    } else {
+        partial_slabs[index] = s->next;
+    }
+    if (s->next != NULL) {
+        s->next->prev = s->prev;
+    }
+    s->next = NULL;
+    s->prev = NULL;
+}
+
+/* Function: slab_alloc
+ * --------------------
+ * This function takes a free slot from the first partial slab of the request's
+ * class, creating a new slab if there is none. The slot is found by scanning the
+ * fixed-size used bitmap, so this is O(1). A slab with no free slots left is taken
+ * off the partial list. Returns NULL if no slab page could be carved.
+ */
+void *slab_alloc(size_t requested_size) {
+    size_t slot_size = roundup(requested_size, PAYLOAD_ALIGNMENT);
+    slab *s = partial_slabs[slot_size / ALIGNMENT - 1];
+    if (s == NULL && (s = new_slab(slot_size)) == NULL) {
+        return NULL;
+    }
+    size_t word = 0;
+    while (~s->used[word] == 0) {
+        word++;
+    }
+    size_t bit = __builtin_ctzl(~s->used[word]);
+    s->used[word] |= 1UL << bit;
+    if (--s->nfree == 0) {
+        unlink_slab(s);
+    }
+    return slab_slots(s) + (word * 64 + bit) * slot_size;
+}
+
+/* Function: slab_free
+ * -------------------
+ * This function clears a slot's bit in its slab. A slab that was full goes back on
+ * the partial list, and a slab that becomes empty is returned to the heap unless it
+ * is the only partial slab of its class, so a class does not thrash on one page.
+ */
+void slab_free(slab *s, void *ptr) {
+    size_t slot = ((char *)ptr - slab_slots(s)) / s->slot_size;
+    s->used[slot / 64] &= ~(1UL << (slot % 64));
+    if (s->nfree++ == 0) {
+        size_t index = s->slot_size / ALIGNMENT - 1;
+        s->prev = NULL;
+        s->next = partial_slabs[index];
+        if (s->next != NULL) {
+            s->next->prev = s;
         }
-        node = node->next;
+        partial_slabs[index] = s;
+    }
+    if (s->nfree == s->nslots && (s->prev != NULL || s->next != NULL)) {
+        unlink_slab(s);
+        size_t page = ((char *)s - (char *)segment_start) / SLAB_SIZE;
+        SHARED_AND(&slab_pages[page / 64], ~(1UL << (page % 64)));
+        free_heap_block((node_block *)s);
+    }
+}
+
+/* Function: block_usable_size
+ * ---------------------------
+ * This function returns how many bytes the client may use in the given block: the
+ * slot size for a slab slot, or the payload size for a heap or huge block.
+ */
+size_t block_usable_size(void *ptr) {
+    if (is_huge(ptr)) {
+        return get_block_size(ptr);
     }
-    printf("Heap space exhausted.\n");
-    return NULL;
+    slab *s = find_slab(ptr);
+    return s != NULL ? s->slot_size : get_block_size(ptr);
 }
 
 /* Function: can_coalesce
@@ -238,108 +1299,619 @@ void *mymalloc(size_t requested_size) {
  * the function returns true. Otherwise, it returns false.
  */
 bool can_coalesce(node_block *ptr) {
-    size_t payload_size = get_block_size(ptr);
-    void *right_block = (char *)ptr + payload_size;
-    if (right_block != heap_end && is_free(right_block)) {
-        return true;
-    }
-    return false;
+    node_block *right_block = right_neighbor(ptr);
+    return right_block != NULL && is_free(get_header(right_block));
 }
 
 /* Function: coalesce
  * ------------------
  * This function coalesces a block and its adjacent right block. It removes the right
- * free block from the free-list and adds its size to that of the current block. It
- * updates all header information accordingly.
+ * free block from the free-list and adds its size to that of the current block. The
+ * current block keeps its flags, picking up the right block's DECOMMITTED_BIT, so the
+ * caller marks the result used or free, which in turn updates the new right neighbor.
  */
 void coalesce(node_block *ptr) {
-    size_t payload_size = get_block_size(ptr);    
-    void *curr_header_temp = (char *)ptr - HEADER_SIZE;
-    block_header *curr_header = (block_header *)curr_header_temp;
-
-    // right block
-    void *right_block_temp = (char *)ptr + payload_size + HEADER_SIZE;
-    node_block *right_block = (node_block *)right_block_temp;
+    node_block *right_block = right_neighbor(ptr);
     size_t right_block_size = get_block_size(right_block);
 
     // remove right block from free list
     remove_node(right_block);
     // add right block size to curr block
-    *curr_header += (right_block_size + HEADER_SIZE);              
+    set_block_size(ptr, get_block_size(ptr) + right_block_size + HEADER_SIZE);
+    *get_header(ptr) |= *get_header(right_block) & DECOMMITTED_BIT;
 }
 
-/* Function: myfree
- * ----------------
- * This function frees a previously allocated block. It coalesces once if possible and
- * sets the header status to free. It adds the node to the free-list, allowing the space
- * to be overwritten in subsequent allocation requests.
+/* Function: free_block
+ * ---------------------
+ * This function frees a previously allocated block. A huge block is unmapped at
+ * once, a slab slot is handed back to its slab, and any other block is freed in
+ * the heap with free_heap_block.
  */
-void myfree(void *ptr) {
-    if (ptr != NULL) {
-        if (can_coalesce(ptr)) {
-            coalesce(ptr);
+void free_block(void *ptr) {
+    slab *s;
+    if (ptr != NULL && is_huge(ptr)) {
+        track_in_use(0, get_block_size(ptr));
+        huge_free(ptr);
+    } else if (ptr != NULL && (s = find_slab(ptr)) != NULL) {
+        track_in_use(0, s->slot_size);
+        slab_free(s, ptr);
+    } else if (ptr != NULL) {
+        track_in_use(0, get_block_size(ptr));
+        free_heap_block(ptr);
+    }
+}
+
+/* Function: free_heap_block
+ * -------------------------
+ * This function frees a used heap block. It coalesces with the right neighbor if
+ * it is free, and with the left neighbor if the header says it is free, using the
+ * left block's footer to find it. It then marks the merged block free and adds it
+ * to the free-list, allowing the space to be overwritten in subsequent allocation
+ * requests. If the merged block is at least DECOMMIT_MIN_SIZE, the pages inside it
+ * that may still be committed are given back to the OS; only the freed block and
+ * neighbors not already flagged DECOMMITTED_BIT need to be considered.
+ */
+void free_heap_block(node_block *ptr) {
+    uncount_small(get_block_size(ptr));
+    // range of the merged block whose pages may still be committed
+    char *dirty_start = (char *)ptr;
+    char *dirty_end = (char *)ptr + get_block_size(ptr);
+    if (can_coalesce(ptr)) {
+        node_block *right_block = right_neighbor(ptr);
+        if ((*get_header(right_block) & DECOMMITTED_BIT) == 0) {
+            dirty_end = (char *)right_block + get_block_size(right_block);
+        }
+        coalesce(ptr);
+    }
+    node_block *left_block = left_neighbor(ptr);
+    if (left_block != NULL) {
+        if ((*get_header(left_block) & DECOMMITTED_BIT) == 0) {
+            dirty_start = (char *)left_block;
+        }
+        remove_node(left_block);
+        set_block_size(left_block, get_block_size(left_block) 
+            + get_block_size(ptr) + HEADER_SIZE);
+        *get_header(left_block) |= *get_header(ptr) & DECOMMITTED_BIT;
+        ptr = left_block;
+    }
+    size_t size = get_block_size(ptr);
+    if (size >= DECOMMIT_MIN_SIZE) {
+        // keep the links at the front and the footer at the back committed
+        char *interior_start = (char *)ptr + NODE_SIZE;
+        char *interior_end = (char *)ptr + size - HEADER_SIZE;
+        dirty_start = dirty_start > interior_start ? dirty_start : interior_start;
+        dirty_end = dirty_end < interior_end ? dirty_end : interior_end;
+        if (dirty_start < dirty_end && segment_decommit(dirty_start, dirty_end - dirty_start)) {
+            *get_header(ptr) |= DECOMMITTED_BIT;
         }
-        // set status to free
-        *(block_header *)((char *)ptr - HEADER_SIZE) |= 1UL;
-        add_node(ptr);
     }
+    set_free(ptr);
+    add_node(ptr);
 }
 
-/* Function: myrealloc
- * -------------------
+/* Function: realloc_block
+ * ------------------------
  * This function reallocates previously used memory. It accounts for a series of scenarios; 
  * if the needed size is less than the old size, it splits the block and returns the old pointer,
  * allowing the conserved space for subsequent allocations. If the needed size greater than the
- * old size, it attempts to perform in-place reallocation by coalescing while possible to try 
- * and make space for the new size. If this is possible, the function splits accordingly once
- * again to conserve the excess space. If all lese fails, the function mallocs a new pointer, 
- * copies the memory to the new location, and frees the old pointer. 
+ * old size, it attempts to perform in-place reallocation by absorbing a free right neighbor.
+ * If that is still too small but a free left neighbor would make up the difference, the
+ * block is merged leftwards and its data moved down. In both cases the function splits
+ * accordingly once again to conserve the excess space. If all else fails, the function
+ * mallocs a new pointer, copies the memory to the new location, and frees the old pointer;
+ * the old block is left untouched until then, so it survives a failed malloc. 
+ * A slab slot is kept if the new size still fits its slot, and moved otherwise.
+ * A huge block is resized with mremap while it stays huge, and a heap block that
+ * grows past HUGE_MIN_SIZE is moved into a mapping of its own. A new size over
+ * MAX_REQUEST_SIZE fails, leaving the block as it was.
  */
-void *myrealloc(void *old_ptr, size_t new_size) {
+void *realloc_block(void *old_ptr, size_t new_size) {
     if (old_ptr == NULL && new_size == 0) {
         return NULL;
     }
     if (old_ptr == NULL && new_size != 0) {
-        return mymalloc(new_size);
+        return malloc_block(new_size);
     }
     if (old_ptr != NULL && new_size == 0) {
-        myfree(old_ptr);
+        free_block(old_ptr);
         return NULL;
     }
-    size_t old_size = get_block_size(old_ptr);
-    size_t needed = new_size <= ALIGNMENT ?
-        PAYLOAD_MIN_SIZE : roundup(new_size, ALIGNMENT);
-    
-    if (needed <= old_size) {
-        // check if we should split
-        if (old_size - needed >= HEADER_SIZE + PAYLOAD_MIN_SIZE) {
-            split_block(old_ptr, needed);
-            add_node((node_block *)((char *)old_ptr + needed + HEADER_SIZE));
-        }
-        return old_ptr;
-    }
-    // while need more space, coalesce if possible
-    while (get_block_size(old_ptr) < needed) {
-        if (can_coalesce(old_ptr)) {
-            coalesce(old_ptr);
-        } else {
-            void *new_ptr = mymalloc(new_size);
+    if (new_size > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+    if (is_huge(old_ptr)) {
+        if (new_size >= HUGE_MIN_SIZE) {
+            size_t old_size = get_block_size(old_ptr);
+            void *new_ptr = huge_realloc(old_ptr, new_size);
             if (new_ptr != NULL) {
-                memcpy(new_ptr, old_ptr, needed);
-                myfree(old_ptr);
-                return new_ptr;
+                track_in_use(get_block_size(new_ptr), old_size);
             }
-            else {
-                return NULL;
+            return new_ptr;
+        }
+        void *new_ptr = malloc_block(new_size);
+        if (new_ptr != NULL) {
+            memcpy(new_ptr, old_ptr, new_size);
+            free_block(old_ptr);
+        }
+        return new_ptr;
+    }
+    slab *s = find_slab(old_ptr);
+    if (s != NULL) {
+        if (new_size <= s->slot_size && new_size > s->slot_size - PAYLOAD_ALIGNMENT) {
+            return old_ptr;
+        }
+        void *new_ptr = malloc_block(new_size);
+        if (new_ptr != NULL) {
+            memcpy(new_ptr, old_ptr, new_size < s->slot_size ? new_size : s->slot_size);
+            free_block(old_ptr);
+        }
+        return new_ptr;
+    }
+    size_t old_size = get_block_size(old_ptr);
+    size_t needed = adjust_size(new_size);
+    
+    // space available in place, absorbing a free right neighbor
+    size_t in_place = old_size;
+    if (needed > old_size && can_coalesce(old_ptr)) {
+        in_place += get_block_size(right_neighbor(old_ptr)) + HEADER_SIZE;
+    }
+    node_block *left_block = needed > in_place ? left_neighbor(old_ptr) : NULL;
+    if (new_size >= HUGE_MIN_SIZE || (needed > in_place && (left_block == NULL || 
+        get_block_size(left_block) + HEADER_SIZE + in_place < needed))) {
+        void *new_ptr = malloc_block(new_size);
+        if (new_ptr != NULL) {
+            memcpy(new_ptr, old_ptr, old_size);
+            free_block(old_ptr);
+        }
+        return new_ptr;
+    }
+    // commit the space before changing anything, so a failure leaves the old block as is
+    node_block *new_ptr = left_block != NULL ? left_block : (node_block *)old_ptr;
+    size_t total = in_place + (left_block != NULL ? get_block_size(left_block) + HEADER_SIZE : 0);
+    size_t commit_len = needed + HEADER_SIZE + NODE_SIZE;
+    bool decommitted = (left_block != NULL && (*get_header(left_block) & DECOMMITTED_BIT))
+        || (in_place > old_size && (*get_header(right_neighbor(old_ptr)) & DECOMMITTED_BIT));
+    if (decommitted && !segment_commit(new_ptr, commit_len < total ? commit_len : total)) {
+        return NULL;
+    }
+    if (in_place > old_size) {
+        coalesce(old_ptr);
+    }
+    if (left_block != NULL) {
+        // absorb the left neighbor and slide the data down into it
+        remove_node(left_block);
+        set_block_size(left_block, total);
+        *get_header(left_block) |= *get_header(old_ptr) & DECOMMITTED_BIT;
+        memmove(new_ptr, old_ptr, old_size);
+    }
+    take_block(new_ptr, needed);
+    track_in_use(get_block_size(new_ptr), old_size);
+    uncount_small(old_size);
+    count_small(get_block_size(new_ptr));
+    return new_ptr;            
+}
+
+#ifdef THREADED
+/* Function: flush_cache
+ * ---------------------
+ * This function returns the oldest blocks of one cache size class to the shared
+ * heap, keeping the first keep blocks cached. The caller must hold heap_lock.
+ */
+void flush_cache(thread_cache *tc, size_t index, size_t keep) {
+    node_block *cur = tc->heads[index];
+    if (keep == 0) {
+        tc->heads[index] = NULL;
+    } else {
+        for (size_t i = 1; i < keep && cur != NULL; i++) {
+            cur = NEXT(cur);
+        }
+        if (cur == NULL) {
+            return;
+        }
+        node_block *last = cur;
+        cur = NEXT(last);
+        last->next = to_link(NULL);
+    }
+    while (cur != NULL) {
+        node_block *next = NEXT(cur);
+        free_block(cur);
+        tc->counts[index]--;
+        cur = next;
+    }
+}
+
+/* Function: release_cache
+ * -----------------------
+ * This function is the thread-exit destructor for a thread's cache. It returns
+ * every cached block to the shared heap so they are not leaked.
+ */
+void release_cache(void *arg) {
+    thread_cache *tc = arg;
+    LOCK_HEAP();
+    if (tc->generation == heap_generation) {
+        for (size_t i = 0; i < NUM_CACHE_CLASSES; i++) {
+            flush_cache(tc, i, 0);
+        }
+    }
+    UNLOCK_HEAP();
+}
+
+/* Functions: lock_before_fork, unlock_after_fork
+ * -----------------------------------------------
+ * These fork handlers hold heap_lock across fork, so the child never inherits it
+ * locked by a thread that does not exist there, and release it in both processes.
+ */
+void lock_before_fork(void) {
+    LOCK_HEAP();
+}
+
+void unlock_after_fork(void) {
+    UNLOCK_HEAP();
+}
+
+/* Function: create_cache_key
+ * --------------------------
+ * This function creates the key whose destructor flushes a thread's cache at exit,
+ * and installs the fork handlers, on the first allocator call of any thread.
+ */
+void create_cache_key(void) {
+    pthread_key_create(&cache_key, release_cache);
+    pthread_atfork(lock_before_fork, unlock_after_fork, unlock_after_fork);
+}
+
+/* Function: current_cache
+ * -----------------------
+ * This function returns the calling thread's cache, first discarding its contents
+ * if they belong to a heap that has since been re-initialized.
+ */
+thread_cache *current_cache(void) {
+    if (cache.generation != heap_generation) {
+        memset(cache.heads, 0, sizeof(cache.heads));
+        memset(cache.counts, 0, sizeof(cache.counts));
+        cache.generation = heap_generation;
+    }
+    if (!cache.registered) {
+        // set first, since registering may allocate and so call back in here
+        cache.registered = true;
+        pthread_once(&cache_key_once, create_cache_key);
+        pthread_setspecific(cache_key, &cache);
+    }
+    return &cache;
+}
+
+/* Function: cache_block
+ * ---------------------
+ * This function pushes a freed block onto the calling thread's cache in the class
+ * of the given size, which may be less than its usable size, and returns true, or
+ * returns false if that size is too large to cache. Once a class reaches
+ * CACHE_CLASS_LIMIT, half of it goes back to the shared heap under a single lock
+ * acquisition.
+ */
+bool cache_block(void *ptr, size_t size) {
+    if (size > CACHE_MAX_SIZE) {
+        return false;
+    }
+    thread_cache *tc = current_cache();
+    size_t index = size / ALIGNMENT;
+    ((node_block *)ptr)->next = to_link(tc->heads[index]);
+    tc->heads[index] = ptr;
+    if (++tc->counts[index] >= CACHE_CLASS_LIMIT) {
+        LOCK_HEAP();
+        flush_cache(tc, index, CACHE_CLASS_LIMIT / 2);
+        UNLOCK_HEAP();
+    }
+    return true;
+}
+#endif
+
+/* Function: mymalloc
+ * ------------------
+ * This function is the public entry point for allocation. In THREADED builds it
+ * first tries to pop a block of the matching size class from the calling thread's
+ * cache without locking; otherwise it allocates from the shared heap under the lock.
+ */
+void *mymalloc(size_t requested_size) {
+#ifdef THREADED
+    if (requested_size != 0 && requested_size <= CACHE_MAX_SIZE) {
+        thread_cache *tc = current_cache();
+        size_t class_size = requested_size <= SLAB_MAX_SIZE ?
+            roundup(requested_size, PAYLOAD_ALIGNMENT) : adjust_size(requested_size);
+        size_t index = class_size / ALIGNMENT;
+        // with compact headers, the class of a heap block just past SLAB_MAX_SIZE also
+        // holds the largest slots, which are smaller
+        if (index * ALIGNMENT < class_size && index * ALIGNMENT <= SLAB_MAX_SIZE) {
+            index++;
+        }
+        node_block *cached = tc->heads[index];
+        if (cached != NULL) {
+            tc->heads[index] = NEXT(cached);
+            tc->counts[index]--;
+            return cached;
+        }
+    }
+#endif
+    LOCK_HEAP();
+    void *ptr = malloc_block(requested_size);
+    UNLOCK_HEAP();
+    return ptr;
+}
+
+/* Function: mycalloc
+ * ------------------
+ * This function is the public entry point for calloc. It allocates from the shared
+ * heap under the lock, bypassing the thread caches, whose blocks are all recycled.
+ * Only the part of the block below the high-water mark as it stood before the
+ * allocation can hold old data, so only that part is zeroed, and a huge block is a
+ * fresh mapping that needs no zeroing at all.
+ */
+void *mycalloc(size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        return NULL;
+    }
+    LOCK_HEAP();
+    char *clean = untouched;
+    char *ptr = malloc_block(total);
+    if (ptr != NULL) {
+        char *end = ptr + total < clean ? ptr + total : clean;
+        if (!is_huge(ptr) && ptr < end) {
+            calloc_written += zero_range(ptr, end);
+        }
+        calloc_bytes += total;
+    }
+    UNLOCK_HEAP();
+    return ptr;
+}
+
+/* Function: myfree
+ * ----------------
+ * This function is the public entry point for free. In THREADED builds a small
+ * block is pushed onto the calling thread's cache for its exact block size. A used
+ * block's size bits, and the slab bit of the page holding it, only change under its
+ * owner, so they can be read here without the lock. Other threads do update the
+ * neighboring flag bits in the same words, which is why those reads and updates
+ * are atomic.
+ */
+void myfree(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+#ifdef THREADED
+    if (cache_block(ptr, block_usable_size(ptr))) {
+        return;
+    }
+#endif
+    LOCK_HEAP();
+    free_block(ptr);
+    UNLOCK_HEAP();
+}
+
+/* Function: compare_addresses
+ * -----------------------------
+ * This function is a qsort comparator ordering pointers by address.
+ */
+int compare_addresses(const void *a, const void *b) {
+    uintptr_t x = *(const uintptr_t *)a;
+    uintptr_t y = *(const uintptr_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Function: mymalloc_batch
+ * ------------------------
+ * This function is the public entry point for batch allocation. It allocates under
+ * a single lock acquisition, bypassing the thread caches. Sizes served by regular
+ * heap blocks are carved as runs of blocks from one free block each, with a single
+ * free-list removal and split per run; slab and huge sizes, and whatever the runs
+ * could not hold, are allocated one at a time.
+ */
+size_t mymalloc_batch(size_t size, size_t n, void *out[]) {
+    if (size == 0 || size > MAX_REQUEST_SIZE) {
+        return 0;
+    }
+    size_t done = 0;
+    LOCK_HEAP();
+    if (size > SLAB_MAX_SIZE && size < HUGE_MIN_SIZE) {
+        size_t needed = adjust_size(size);
+        size_t carved;
+        while (done < n && (carved = carve_batch(needed, n - done, out + done)) > 0) {
+            done += carved;
+        }
+    }
+    for (; done < n; done++) {
+        if ((out[done] = malloc_block(size)) == NULL) {
+            break;
+        }
+    }
+    UNLOCK_HEAP();
+    return done;
+}
+
+/* Function: myfree_batch
+ * ----------------------
+ * This function is the public entry point for batch free. It sorts ptrs in place by
+ * address, then frees under a single lock acquisition, bypassing the thread caches.
+ * Each run of heap blocks that follow one another is merged into one block before it
+ * is freed, so the run is coalesced with its neighbors and added to the free-list
+ * only once. Slab slots and huge blocks are freed one at a time.
+ */
+void myfree_batch(void *ptrs[], size_t n) {
+    qsort(ptrs, n, sizeof(void *), compare_addresses);
+    LOCK_HEAP();
+    size_t i = 0;
+    while (i < n) {
+        node_block *first = ptrs[i];
+        if (first == NULL || is_huge(first) || find_slab(first) != NULL) {
+            free_block(first);
+            i++;
+            continue;
+        }
+        node_block *last = first;
+        size_t freed = get_block_size(first);
+        size_t small = is_small_block(freed);
+        size_t j = i + 1;
+        while (j < n && ptrs[j] == right_neighbor(last)) {
+            last = ptrs[j++];
+            freed += get_block_size(last);
+            small += is_small_block(get_block_size(last));
+        }
+        if (j > i + 1) {
+            size_t merged = (char *)last + get_block_size(last) - (char *)first;
+            // free_heap_block uncounts the merged block if it is small, so take off
+            // the rest of the run's small blocks here
+            size_t uncounted = small - is_small_block(merged);
+            if (!slabs_enabled) {
+                small_live -= uncounted < small_live ? uncounted : small_live;
             }
+            set_block_size(first, merged);
         }
+        track_in_use(0, freed);
+        free_heap_block(first);
+        i = j;
     }
-    // if we should split, split
-    if (get_block_size(old_ptr) - needed >= HEADER_SIZE + PAYLOAD_MIN_SIZE) {
-        split_block(old_ptr, needed);
-        add_node((node_block *)((char *)old_ptr + needed + HEADER_SIZE));
+    UNLOCK_HEAP();
+}
+
+/* Function: myfree_sized
+ * ----------------------
+ * This function is the public entry point for sized free. The size, anything from
+ * the size the block was last requested with up to its usable size, stands in for
+ * the header: rounded as mymalloc rounds it, it picks a THREADED build's cache class
+ * with no header read, and it gives the in_use delta of a slab slot or a huge block,
+ * whose mapping is unmapped without reading its header. Only a size of at most
+ * SLAB_MAX_SIZE needs the slab lookup. A heap block's header is still read, since
+ * coalescing needs it anyway and it also counts a remainder too small to split off.
+ */
+void myfree_sized(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return;
+    }
+#ifdef THREADED
+    if (size <= CACHE_MAX_SIZE) {
+        // the smaller of the slot and heap block sizes, so either kind of block fits
+        size_t class_size = adjust_size(size);
+        if (size <= SLAB_MAX_SIZE && roundup(size, PAYLOAD_ALIGNMENT) < class_size) {
+            class_size = roundup(size, PAYLOAD_ALIGNMENT);
+        }
+        if (cache_block(ptr, class_size)) {
+            return;
+        }
+    }
+#endif
+    LOCK_HEAP();
+    slab *s;
+    if (is_huge(ptr)) {
+        size_t len = huge_length(ptr, size);
+        track_in_use(0, fit_size(huge_mapping(ptr) + len - (char *)ptr));
+        munmap(huge_mapping(ptr), len);
+    } else if (size <= SLAB_MAX_SIZE && (s = find_slab(ptr)) != NULL) {
+        track_in_use(0, roundup(size, PAYLOAD_ALIGNMENT));
+        slab_free(s, ptr);
+    } else {
+        track_in_use(0, get_block_size(ptr));
+        free_heap_block(ptr);
+    }
+    UNLOCK_HEAP();
+}
+
+/* Function: myusable_size
+ * -----------------------
+ * This function is the public entry point for the usable size of a block, which
+ * includes the slack left by rounding and by a remainder too small to split off.
+ * The block's size bits only change under its owner, so no lock is needed; as in
+ * myfree, the header and slab bits are read atomically.
+ */
+size_t myusable_size(void *ptr) {
+    return ptr != NULL ? block_usable_size(ptr) : 0;
+}
+
+/* Function: myrealloc
+ * -------------------
+ * This function is the public entry point for realloc. It resizes the block in the
+ * shared heap under the lock.
+ */
+void *myrealloc(void *old_ptr, size_t new_size) {
+    LOCK_HEAP();
+    void *ptr = realloc_block(old_ptr, new_size);
+    UNLOCK_HEAP();
+    return ptr;
+}
+
+/* Function: myaligned_alloc
+ * -------------------------
+ * This function is the public entry point for aligned allocation. Alignments the
+ * payloads already have are served by mymalloc. Otherwise, under the lock, a huge
+ * request gets an aligned mapping of its own, as mymalloc would give it one, and any
+ * other block is carved from a free heap block, with the slack in front of it split
+ * off as a free block; carve_aligned needs at least a minimum block's alignment,
+ * which also meets any smaller one.
+ */
+void *myaligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+    if (alignment <= PAYLOAD_ALIGNMENT) {
+        return mymalloc(size);
+    }
+    if (size == 0 || size > MAX_REQUEST_SIZE || alignment > MAX_REQUEST_SIZE) {
+        return NULL;
     }
-    return old_ptr;            
+    size_t carve_alignment = alignment;
+    while (carve_alignment < HEADER_SIZE + PAYLOAD_MIN_SIZE) {
+        carve_alignment *= 2;
+    }
+    LOCK_HEAP();
+    node_block *ptr;
+    if (size >= HUGE_MIN_SIZE) {
+        ptr = huge_alloc(size, alignment);
+    } else if ((ptr = carve_aligned(carve_alignment, adjust_size(size))) != NULL) {
+        count_small(get_block_size(ptr));
+    }
+    if (ptr != NULL) {
+        track_in_use(get_block_size(ptr), 0);
+    }
+    UNLOCK_HEAP();
+    return ptr;
+}
+
+/* Function: myposix_memalign
+ * --------------------------
+ * This function checks the alignment and hands the request to myaligned_alloc,
+ * reporting the outcome as posix_memalign does.
+ */
+int myposix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || 
+        alignment % sizeof(void *) != 0) {
+        return EINVAL;
+    }
+    void *ptr = myaligned_alloc(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+/* Function: myheapstats
+ * ---------------------
+ * This function returns the heap statistics from the counters kept up to date by
+ * every allocation and free, so it takes O(1) time whatever the size of the heap.
+ */
+heapstats_t myheapstats(void) {
+    LOCK_HEAP();
+    heapstats_t stats = {
+        .in_use = in_use,
+        .free = free_bytes,
+        .free_blocks = free_count,
+        .largest_free = largest_free != NULL ? get_block_size(largest_free) : 0,
+        .peak_in_use = peak_in_use,
+        .heap_extent = (char *)(top_block != NULL ? get_header(top_block) : heap_end) 
+            - (char *)segment_start,
+        .calloc_bytes = calloc_bytes,
+        .calloc_written = calloc_written
+    };
+    UNLOCK_HEAP();
+    stats.fragmentation = stats.free > 0 ? 1 - (double)stats.largest_free / stats.free : 0;
+    return stats;
 }
 
 /* Function validate_heap
@@ -0,0 +1,446 @@
+/* File: gen_script.c
+ * ------------------
+ * Generates synthetic allocator scripts in the a/r/f format read by the test
+ * harness, so allocators can be measured on workloads of any length and live
+ * set size. The generator allocates until the live set reaches its target,
+ * then alternates between freeing the block due to die first and allocating a
+ * new one; some allocations are replaced by reallocs of a random live block.
+ * Ids of freed blocks are reused, so the largest id stays near the live set
+ * size however many ops are generated. Every block still live after the last
+ * op is freed at the end.
+ *
+ * Usage: gen_script [-n ops] [-l live] [-s sizes] [-m max-size] [-d lifetimes]
+ *                   [-p realloc-prob] [-g growth] [-S seed] [-o output]
+ *
+ *   sizes:     uniform:MIN:MAX | lognormal:MEDIAN:SIGMA |
+ *              bimodal:SMALL:LARGE:FRACTION_LARGE | trace:SCRIPT_FILE
+ *   lifetimes: random | fifo | lifo | exp:MEAN_OPS
+ *   growth:    factor:F | add:BYTES | resample
+ *
+ * Every size, including each realloc's grown size, is capped at max-size.
+ */
+
+#include <error.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "allocator.h"
+
+// default number of ops to generate, before the final frees
+#define DEFAULT_OPS 100000
+// default number of blocks live at once in the steady state
+#define DEFAULT_LIVE 1000
+// default chance that an allocation is replaced by a realloc of a live block
+#define DEFAULT_REALLOC_PROB 0.1
+// default cap on sizes, so repeated growth cannot exhaust the heap
+#define DEFAULT_MAX_SIZE (1 << 20)
+// largest number of ops one script may hold
+#define MAX_OPS 100000000L
+// largest line read from a trace whose sizes are replayed
+#define MAX_LINE_LEN 1024
+
+// size distributions
+enum size_dist { UNIFORM, LOGNORMAL, BIMODAL, TRACE };
+// lifetime distributions, each deciding which live block dies next
+enum lifetime_dist { RANDOM, FIFO, LIFO, EXPONENTIAL };
+// realloc growth patterns
+enum growth { FACTOR, ADD, RESAMPLE };
+
+// struct for all generator parameters
+typedef struct {
+    long nops;
+    int live;
+    double realloc_prob;
+    enum size_dist sizes;
+    double size_a, size_b, size_c;  // parameters of the size distribution
+    size_t *trace_sizes;            // sizes replayed for the trace distribution
+    size_t num_trace_sizes;
+    size_t max_size;
+    enum lifetime_dist lifetimes;
+    double mean_lifetime;
+    enum growth growth;
+    double growth_amount;
+    uint64_t seed;
+} params_t;
+
+// struct for one live block
+typedef struct {
+    size_t size;
+    double death;       // when the block is due to be freed; lowest dies first
+    int heap_pos;       // position in the death-ordered heap
+} live_t;
+
+// struct for the generator's state
+typedef struct {
+    params_t *params;
+    uint64_t rng;
+    live_t *blocks;     // indexed by id
+    int *heap;          // ids of live blocks, a binary min-heap on death
+    int nlive;
+    int *free_ids;      // stack of ids not currently live
+    int nfree_ids;
+    long clock;         // ops generated so far
+    FILE *out;
+} gen_t;
+
+/* Function: next_random
+ * ---------------------
+ * Returns the next value of a xorshift64* generator, so scripts are
+ * reproducible from their seed on every platform.
+ */
+static uint64_t next_random(gen_t *g) {
+    g->rng ^= g->rng >> 12;
+    g->rng ^= g->rng << 25;
+    g->rng ^= g->rng >> 27;
+    return g->rng * 0x2545F4914F6CDD1DUL;
+}
+
+/* Function: uniform01
+ * -------------------
+ * Returns a uniformly distributed double in [0, 1).
+ */
+static double uniform01(gen_t *g) {
+    return (next_random(g) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Function: normal
+ * ----------------
+ * Returns a standard normal sample, by the Box-Muller transform.
+ */
+static double normal(gen_t *g) {
+    double u = 1.0 - uniform01(g);
+    return sqrt(-2.0 * log(u)) * cos(2 * M_PI * uniform01(g));
+}
+
+/* Function: clamp_size
+ * --------------------
+ * Rounds a sampled size to whole bytes within [1, max_size].
+ */
+static size_t clamp_size(double size, size_t max_size) {
+    if (size < 1) {
+        return 1;
+    }
+    if (size > max_size) {
+        return max_size;
+    }
+    return (size_t)(size + 0.5);
+}
+
+/* Function: sample_size
+ * ---------------------
+ * Returns a request size drawn from the configured size distribution. The two
+ * bimodal modes are each spread uniformly over +-25% of their size.
+ */
+static size_t sample_size(gen_t *g) {
+    params_t *p = g->params;
+    switch (p->sizes) {
+        case UNIFORM:
+            return clamp_size(p->size_a + uniform01(g) * (p->size_b - p->size_a), 
+                p->max_size);
+        case LOGNORMAL:
+            return clamp_size(p->size_a * exp(p->size_b * normal(g)), p->max_size);
+        case BIMODAL: {
+            double mode = uniform01(g) < p->size_c ? p->size_b : p->size_a;
+            return clamp_size(mode * (0.75 + 0.5 * uniform01(g)), p->max_size);
+        }
+        case TRACE:
+            return clamp_size(p->trace_sizes[next_random(g) % p->num_trace_sizes], 
+                p->max_size);
+    }
+    return 1;
+}
+
+/* Function: sample_death
+ * ----------------------
+ * Returns the death time of a block born now: its birth time for FIFO, minus
+ * it for LIFO, a random key for RANDOM, or its birth time plus an exponential
+ * lifetime. The block with the lowest death time is freed first.
+ */
+static double sample_death(gen_t *g) {
+    switch (g->params->lifetimes) {
+        case RANDOM:
+            return uniform01(g);
+        case FIFO:
+            return g->clock;
+        case LIFO:
+            return -g->clock;
+        case EXPONENTIAL:
+            return g->clock - g->params->mean_lifetime * log(1.0 - uniform01(g));
+    }
+    return 0;
+}
+
+/* Function: grow_size
+ * -------------------
+ * Returns the new size of a block being realloc'ed from the given size.
+ */
+static size_t grow_size(gen_t *g, size_t size) {
+    switch (g->params->growth) {
+        case FACTOR:
+            return clamp_size(size * g->params->growth_amount, g->params->max_size);
+        case ADD:
+            return clamp_size(size + g->params->growth_amount, g->params->max_size);
+        case RESAMPLE:
+            return sample_size(g);
+    }
+    return size;
+}
+
+/* Functions: heap_swap, heap_up, heap_down
+ * ----------------------------------------
+ * Maintain the min-heap of live ids ordered by death time, keeping each
+ * block's heap_pos up to date.
+ */
+static void heap_swap(gen_t *g, int i, int j) {
+    int tmp = g->heap[i];
+    g->heap[i] = g->heap[j];
+    g->heap[j] = tmp;
+    g->blocks[g->heap[i]].heap_pos = i;
+    g->blocks[g->heap[j]].heap_pos = j;
+}
+
+static void heap_up(gen_t *g, int i) {
+    while (i > 0 && g->blocks[g->heap[i]].death < g->blocks[g->heap[(i - 1) / 2]].death) {
+        heap_swap(g, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_down(gen_t *g, int i) {
+    while (true) {
+        int least = i;
+        for (int child = 2 * i + 1; child <= 2 * i + 2 && child < g->nlive; child++) {
+            if (g->blocks[g->heap[child]].death < g->blocks[g->heap[least]].death) {
+                least = child;
+            }
+        }
+        if (least == i) {
+            return;
+        }
+        heap_swap(g, i, least);
+        i = least;
+    }
+}
+
+/* Function: emit_alloc
+ * --------------------
+ * Writes an allocation of a new block under a free id and makes it live.
+ */
+static void emit_alloc(gen_t *g) {
+    int id = g->free_ids[--g->nfree_ids];
+    live_t *b = &g->blocks[id];
+    b->size = sample_size(g);
+    b->death = sample_death(g);
+    b->heap_pos = g->nlive;
+    g->heap[g->nlive++] = id;
+    heap_up(g, b->heap_pos);
+    fprintf(g->out, "a %d %zu\n", id, b->size);
+}
+
+/* Function: emit_realloc
+ * ----------------------
+ * Writes a realloc of a randomly chosen live block to its grown size. The
+ * block keeps its death time.
+ */
+static void emit_realloc(gen_t *g) {
+    int id = g->heap[next_random(g) % g->nlive];
+    g->blocks[id].size = grow_size(g, g->blocks[id].size);
+    fprintf(g->out, "r %d %zu\n", id, g->blocks[id].size);
+}
+
+/* Function: emit_free
+ * -------------------
+ * Writes a free of the live block due to die first and recycles its id.
+ */
+static void emit_free(gen_t *g) {
+    int id = g->heap[0];
+    heap_swap(g, 0, --g->nlive);
+    heap_down(g, 0);
+    g->free_ids[g->nfree_ids++] = id;
+    fprintf(g->out, "f %d\n", id);
+}
+
+/* Function: generate
+ * ------------------
+ * Writes the whole script: nops steady-state ops followed by frees of every
+ * block still live.
+ */
+static void generate(gen_t *g) {
+    params_t *p = g->params;
+    for (g->clock = 0; g->clock < p->nops; g->clock++) {
+        if (g->nlive == p->live) {
+            emit_free(g);
+        } else if (g->nlive > 0 && uniform01(g) < p->realloc_prob) {
+            emit_realloc(g);
+        } else {
+            emit_alloc(g);
+        }
+    }
+    while (g->nlive > 0) {
+        emit_free(g);
+    }
+}
+
+/* Function: read_trace_sizes
+ * --------------------------
+ * Collects the size of every a and r request in the given script, so sizes can
+ * be replayed with the same histogram.
+ */
+static void read_trace_sizes(params_t *p, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        error(1, 0, "Could not open script file \"%s\".", path);
+    }
+    size_t nallocated = 0;
+    char line[MAX_LINE_LEN];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char op;
+        int id;
+        size_t size;
+        if (sscanf(line, " %c %d %zu", &op, &id, &size) != 3 || (op != 'a' && op != 'r')) {
+            continue;
+        }
+        if (p->num_trace_sizes == nallocated) {
+            nallocated = nallocated ? 2 * nallocated : 1024;
+            p->trace_sizes = realloc(p->trace_sizes, nallocated * sizeof(size_t));
+            if (p->trace_sizes == NULL) {
+                error(1, 0, "Libc heap exhausted. Cannot continue.");
+            }
+        }
+        p->trace_sizes[p->num_trace_sizes++] = size;
+    }
+    fclose(fp);
+    if (p->num_trace_sizes == 0) {
+        error(1, 0, "Script file \"%s\" has no allocation sizes.", path);
+    }
+}
+
+/* Function: parse_sizes
+ * ---------------------
+ * Parses the -s argument into the size distribution and its parameters.
+ */
+static void parse_sizes(params_t *p, const char *arg) {
+    if (sscanf(arg, "uniform:%lf:%lf", &p->size_a, &p->size_b) == 2 &&
+        p->size_a <= p->size_b) {
+        p->sizes = UNIFORM;
+    } else if (sscanf(arg, "lognormal:%lf:%lf", &p->size_a, &p->size_b) == 2) {
+        p->sizes = LOGNORMAL;
+    } else if (sscanf(arg, "bimodal:%lf:%lf:%lf", &p->size_a, &p->size_b, &p->size_c) == 3) {
+        p->sizes = BIMODAL;
+    } else if (strncmp(arg, "trace:", strlen("trace:")) == 0) {
+        p->sizes = TRACE;
+        read_trace_sizes(p, arg + strlen("trace:"));
+    } else {
+        error(1, 0, "Unknown size distribution \"%s\".", arg);
+    }
+}
+
+/* Function: parse_lifetimes
+ * -------------------------
+ * Parses the -d argument into the lifetime distribution.
+ */
+static void parse_lifetimes(params_t *p, const char *arg) {
+    if (strcmp(arg, "random") == 0) {
+        p->lifetimes = RANDOM;
+    } else if (strcmp(arg, "fifo") == 0) {
+        p->lifetimes = FIFO;
+    } else if (strcmp(arg, "lifo") == 0) {
+        p->lifetimes = LIFO;
+    } else if (sscanf(arg, "exp:%lf", &p->mean_lifetime) == 1 && p->mean_lifetime > 0) {
+        p->lifetimes = EXPONENTIAL;
+    } else {
+        error(1, 0, "Unknown lifetime distribution \"%s\".", arg);
+    }
+}
+
+/* Function: parse_growth
+ * ----------------------
+ * Parses the -g argument into the realloc growth pattern.
+ */
+static void parse_growth(params_t *p, const char *arg) {
+    if (sscanf(arg, "factor:%lf", &p->growth_amount) == 1 && p->growth_amount > 0) {
+        p->growth = FACTOR;
+    } else if (sscanf(arg, "add:%lf", &p->growth_amount) == 1) {
+        p->growth = ADD;
+    } else if (strcmp(arg, "resample") == 0) {
+        p->growth = RESAMPLE;
+    } else {
+        error(1, 0, "Unknown growth pattern \"%s\".", arg);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    params_t p = {
+        .nops = DEFAULT_OPS, .live = DEFAULT_LIVE, .realloc_prob = DEFAULT_REALLOC_PROB,
+        .sizes = UNIFORM, .size_a = 1, .size_b = 1024, .max_size = DEFAULT_MAX_SIZE,
+        .lifetimes = RANDOM,
+        .growth = FACTOR, .growth_amount = 2, .seed = 1
+    };
+    const char *output = NULL;
+    int c;
+    while ((c = getopt(argc, argv, "n:l:s:m:d:p:g:S:o:")) != -1) {
+        if (c == 'n') {
+            p.nops = atol(optarg);
+        } else if (c == 'l') {
+            p.live = atoi(optarg);
+        } else if (c == 's') {
+            parse_sizes(&p, optarg);
+        } else if (c == 'm') {
+            p.max_size = atol(optarg);
+        } else if (c == 'd') {
+            parse_lifetimes(&p, optarg);
+        } else if (c == 'p') {
+            p.realloc_prob = atof(optarg);
+        } else if (c == 'g') {
+            parse_growth(&p, optarg);
+        } else if (c == 'S') {
+            p.seed = strtoull(optarg, NULL, 0);
+        } else if (c == 'o') {
+            output = optarg;
+        } else {
+            error(1, 0, "Usage: %s [-n ops] [-l live] [-s sizes] [-m max-size] "
+                "[-d lifetimes] [-p realloc-prob] [-g growth] [-S seed] [-o output]", argv[0]);
+        }
+    }
+    if (p.nops <= 0 || p.nops > MAX_OPS || p.live <= 0) {
+        error(1, 0, "Need 1 to %ld ops and a positive live set size.", MAX_OPS);
+    }
+    if (p.max_size == 0 || p.max_size > MAX_REQUEST_SIZE) {
+        error(1, 0, "Max size must be between 1 and %d.", MAX_REQUEST_SIZE);
+    }
+
+    gen_t g = { .params = &p, .rng = p.seed ? p.seed : 1, .out = stdout };
+    if (output != NULL && (g.out = fopen(output, "w")) == NULL) {
+        error(1, 0, "Could not create script file \"%s\".", output);
+    }
+    g.blocks = malloc(p.live * sizeof(live_t));
+    g.heap = malloc(p.live * sizeof(int));
+    g.free_ids = malloc(p.live * sizeof(int));
+    if (g.blocks == NULL || g.heap == NULL || g.free_ids == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    // push ids so that the lowest is handed out first
+    for (int id = p.live - 1; id >= 0; id--) {
+        g.free_ids[g.nfree_ids++] = id;
+    }
+
+    fprintf(g.out, "# generated by:");
+    for (int i = 0; i < argc; i++) {
+        fprintf(g.out, " %s", argv[i]);
+    }
+    fprintf(g.out, "\n");
+    generate(&g);
+
+    if (fclose(g.out) != 0) {
+        error(1, 0, "Could not write script.");
+    }
+    free(g.blocks);
+    free(g.heap);
+    free(g.free_ids);
+    free(p.trace_sizes);
+    return 0;
+}
@@ -7,11 +7,14 @@
  * reallocating memory.
  */
 
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "./allocator.h"
 #include "./debug_break.h"
+#include "./segment.h"
 
 // how many bytes are printed per line in dump_heap
 #define BYTES_PER_LINE 32
@@ -19,6 +22,16 @@
 #define HEADER_SIZE 8
 // total heap size
 #define HEAP_SIZE 4294967296
+// granularity in which heap memory is committed
+#define COMMIT_CHUNK (64 * 1024)
+// free block search policies: first fit scans from the start of the heap on every
+// request, next fit resumes from where the last allocation ended
+#define FIRST_FIT 0
+#define NEXT_FIT 1
+// policy in use; build with -DFIT_POLICY=FIRST_FIT to switch
+#ifndef FIT_POLICY
+#define FIT_POLICY NEXT_FIT
+#endif
 
 /* type block_header to denote an 8 byte block of memory containing the header
  * which stores the size of the block with the LSB indicating the status.
@@ -26,9 +39,29 @@
 typedef size_t block_header; 
 
 static block_header *curr;
+static block_header *rover;
+// the last block in the heap; when free, it is the wilderness
+static block_header *top;
+// no free block other than the wilderness is larger than this, even once merged with
+// its free neighbors; SIZE_MAX when a free since the last failed search may have
+// changed that
+static size_t free_limit;
 static void *segment_start;
 static void *segment_end;
 static void *heap_end;
+static void *commit_end;
+// payload bytes handed out, and the most there have been since myinit
+static size_t in_use;
+static size_t peak_in_use;
+// bytes requested from mycalloc since myinit, all of them zeroed by writing
+static size_t calloc_bytes;
+
+// nothing above is locked, so only one thread may call in at a time
+const bool allocator_thread_safe = false;
+
+bool commit_to(void *end);
+void *allocate_at_curr(size_t needed);
+void track_in_use(size_t added, size_t removed);
 
 /* Function: myinit
  * ----------------
@@ -38,12 +71,22 @@ static void *heap_end;
 bool myinit(void *heap_start, size_t heap_size) {
     segment_start = heap_start;
     segment_end = heap_start;
+    commit_end = heap_start;
+    heap_end = (char *)heap_start + heap_size;
+    in_use = 0;
+    peak_in_use = 0;
+    calloc_bytes = 0;
+    if (!commit_to((char *)heap_start + HEADER_SIZE)) {
+        return false;
+    }
     curr = heap_start;
+    rover = heap_start;
+    top = heap_start;
+    free_limit = 0;
     // initialize size of block
     *curr = (heap_size - HEADER_SIZE);
     // initialize status to free 
     *curr |= 1UL; 
-    heap_end = (char *)heap_start + heap_size;
     
     return true;
 }
@@ -84,6 +127,29 @@ size_t roundup(size_t sz, size_t mult) {
     return (sz + mult - 1) & ~(mult - 1);
 }
 
+/* Function: commit_to
+ * -------------------
+ * This function makes sure the heap is committed up to at least the given address,
+ * growing the committed region in COMMIT_CHUNK steps. Headers are only ever written
+ * just past the highest block handed out, so everything the allocator touches lies
+ * below commit_end. It returns false if the memory could not be committed.
+ */
+bool commit_to(void *end) {
+    if (end <= commit_end) {
+        return true;
+    }
+    void *new_end = (char *)segment_start 
+        + roundup((char *)end - (char *)segment_start, COMMIT_CHUNK);
+    if (new_end > heap_end) {
+        new_end = heap_end;
+    }
+    if (!segment_commit(commit_end, (char *)new_end - (char *)commit_end)) {
+        return false;
+    }
+    commit_end = new_end;
+    return true;
+}
+
 /* Function: dump_heap
  * -------------------
  * This function is a debugging tool. It prints out useful information about the 
@@ -98,83 +164,410 @@ void dump_heap(size_t requested_size) {
            curr, header_size, status);
 }
 
+/* Function: coalesce
+ * ------------------
+ * This function merges every free block directly to the right of the block at curr
+ * into it, stopping at the first used block or the end of the heap. Headers carry no
+ * footers, so blocks can only be merged rightwards. If the rover pointed at one of
+ * the merged headers it is moved back to curr, so it always points at a live header.
+ * The function returns true if the header stop was one of those merged.
+ */
+bool coalesce(block_header *stop) {
+    bool merged_stop = false;
+    block_header *next = (block_header *)((char *)curr + get_block_size(curr) + HEADER_SIZE);
+    while ((void *)next != heap_end && (*next & 1UL) == 1) {
+        if (next == rover) {
+            rover = curr;
+        }
+        if (next == top) {
+            top = curr;
+        }
+        merged_stop |= next == stop;
+        size_t merged_size = get_block_size(curr) + HEADER_SIZE + get_block_size(next);
+        *curr = merged_size | (*curr & 1UL);
+        next = (block_header *)((char *)curr + merged_size + HEADER_SIZE);
+    }
+    return merged_stop;
+}
+
+/* Function: place_block
+ * ---------------------
+ * This function marks the block at curr as used with a payload of needed bytes,
+ * which must not exceed its size. If enough is left over for another header, the
+ * remainder is split off as a new free block; its header is committed first. The
+ * function returns false, changing nothing, if that memory could not be committed.
+ */
+bool place_block(size_t needed) {
+    size_t remaining = get_block_size(curr);
+    bool split = remaining - needed >= HEADER_SIZE;
+    // move pointer to location after payload
+    segment_end = (char *)curr + HEADER_SIZE + needed;
+    // commit the payload and the header of any split-off remainder
+    if (!commit_to((char *)segment_end + (split ? HEADER_SIZE : 0))) {
+        return false;
+    }
+    if (split) {
+        // initialize size of new block
+        *(block_header *)segment_end = (remaining - needed - HEADER_SIZE);
+        // initialize status to free
+        *(block_header *)segment_end |= 1UL;
+        if (curr == top) {
+            top = segment_end;
+        }
+    }
+    // update size of current block and its status to used
+    *curr = split ? needed : remaining;
+    return true;
+}
+
+/* Function: aligned_slack
+ * -----------------------
+ * This function returns how far past the start of the free block at curr's payload
+ * a payload aligned to the given alignment starts. Any slack in front of the aligned
+ * payload is split off as a free block of its own, so it needs room for a header; if
+ * it is too small for one, the payload moves up by another alignment step.
+ */
+size_t aligned_slack(size_t alignment) {
+    char *payload = (char *)curr + HEADER_SIZE;
+    char *aligned = (char *)roundup((uintptr_t)payload, alignment);
+    if (aligned != payload && aligned - payload < HEADER_SIZE) {
+        aligned += alignment;
+    }
+    return aligned - payload;
+}
+
+/* Function: fits
+ * --------------
+ * This function returns true if the block at curr can hold a payload of needed bytes
+ * at the given alignment.
+ */
+bool fits(size_t needed, size_t alignment) {
+    return aligned_slack(alignment) + needed <= get_block_size(curr);
+}
+
+/* Function: find_fit
+ * ------------------
+ * This function searches the headers for a free block that can hold a payload of
+ * needed bytes at the given alignment, leaving curr at it and returning true, or
+ * returning false if there is none. The search starts at the rover, the header just
+ * past the last block allocated (or at the start of the heap under FIRST_FIT), and
+ * wraps around the end of the heap, so each header is visited at most once. Each free
+ * block it visits first absorbs the free blocks following it, so freed neighbors are
+ * coalesced lazily. The wilderness, the free block running to the end of the heap,
+ * always fits, so it is only used once no other block does; otherwise the rover would
+ * settle in it and never reuse freed blocks. A search that finds no other block
+ * records the largest one it passed in free_limit, and until a free raises it again,
+ * any request larger than that goes straight to the wilderness instead of walking
+ * every header.
+ */
+bool find_fit(size_t needed, size_t alignment) {
+    if (needed > free_limit && (*top & 1UL) == 1) {
+        curr = top;
+        if (fits(needed, alignment)) {
+            return true;
+        }
+    }
+#if FIT_POLICY == FIRST_FIT
+    curr = segment_start;
+#else
+    curr = rover;
+#endif
+    block_header *search_start = curr;
+    block_header *wilderness = NULL;
+    size_t largest = 0;
+    do {
+        if (is_free()) {
+            // merging the block the search started at means every header was visited
+            bool wrapped = coalesce(search_start);
+            if (curr == top) {
+                wilderness = fits(needed, alignment) ? curr : NULL;
+            } else if (fits(needed, alignment)) {
+                return true;
+            } else if (get_block_size(curr) > largest) {
+                largest = get_block_size(curr);
+            }
+            if (wrapped) {
+                break;
+            }
+        }
+        next_header();
+        if (curr == heap_end) {
+            curr = segment_start;
+        }
+    } while (curr != search_start);
+    // every free block was visited and merged with its free neighbors
+    free_limit = largest;
+    curr = wilderness;
+    return wilderness != NULL;
+}
+
 /* Function: mymalloc
  * -------------------
- * This function completes the client's allocation request. It searches the headers
- * for a free block of viable size and returns the pointer to the location at which the 
- * client's request should be allocated. It then splits the block if possible to accomodate
- * following requests, initializing header information as well as updating header information
- * for the newly allocated block.
+ * This function completes the client's allocation request. It finds a free block of
+ * viable size with find_fit and returns the pointer to the location at which the
+ * client's request should be allocated. It then splits the block if possible to
+ * accomodate following requests, initializing header information as well as updating
+ * header information for the newly allocated block.
  */
 void *mymalloc(size_t requested_size) {
     if ((requested_size > MAX_REQUEST_SIZE) || (requested_size == 0)) {
         return NULL;
     }
     size_t needed = roundup(requested_size, ALIGNMENT);
-    curr = segment_start;
-    while (curr != heap_end) {
-        // check if status is free and block size >= needed size
-        if (is_free() && get_block_size(curr) >= needed) {
-            size_t remaining = get_block_size(curr);
-            void *payload_ptr = (char *)curr + HEADER_SIZE;
-            // move pointer to location after payload
-            segment_end = (char *)curr + HEADER_SIZE + needed;
-            if (remaining - needed >= HEADER_SIZE) {
-                // initialize size of new block
-                *(block_header *)segment_end = (remaining - needed - HEADER_SIZE);
-                // initialize status to free
-                *(block_header *)segment_end |= 1UL;
-            }
-            // update size of current block
-            *curr = needed;
-            // update status of current block to used
-            *curr &= ~1;
-            curr = segment_end;
-            
-            return payload_ptr;
-        }
-        next_header();
+    if (!find_fit(needed, ALIGNMENT)) {
+        printf("Heap space exhausted.\n");
+        return NULL;
+    }
+    return allocate_at_curr(needed);
+}
+
+/* Function: mycalloc
+ * ------------------
+ * This function allocates a block with mymalloc and zeroes it with memset. Free
+ * blocks are recycled without any record of what they held, so no part of a
+ * block is known to be zero.
+ */
+void *mycalloc(size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        return NULL;
+    }
+    void *ptr = mymalloc(total);
+    if (ptr != NULL) {
+        memset(ptr, 0, total);
+        calloc_bytes += total;
+    }
+    return ptr;
+}
+
+/* Function: allocate_at_curr
+ * --------------------------
+ * This function hands out the free block at curr for a payload of needed bytes and
+ * leaves the rover just past it. It returns the payload, or NULL if the memory could
+ * not be committed.
+ */
+void *allocate_at_curr(size_t needed) {
+    if (!place_block(needed)) {
+        printf("Heap space exhausted.\n");
+        return NULL;
+    }
+    track_in_use(get_block_size(curr), 0);
+    void *payload_ptr = (char *)curr + HEADER_SIZE;
+    curr = segment_end;
+    rover = curr != heap_end ? curr : segment_start;
+    return payload_ptr;
+}
+
+/* Function: track_in_use
+ * ----------------------
+ * This function updates in_use for blocks handed out and given back, of added and
+ * removed payload bytes, and raises the high-water mark if it was passed.
+ */
+void track_in_use(size_t added, size_t removed) {
+    in_use = in_use + added - removed;
+    if (in_use > peak_in_use) {
+        peak_in_use = in_use;
     }
-    printf("Heap space exhausted.\n");
-    return NULL;
 }
 
 /* Function: myfree
  * ----------------
  * This function frees a previously allocated block by updating the header status to
- * free, allowing the space to be overwritten by subsequent allocation requests.
+ * free, allowing the space to be overwritten by subsequent allocation requests. The
+ * block is merged with its free neighbors when a later search or realloc reaches it.
  */
 void myfree(void *ptr) {
     if (ptr != NULL) {
         ptr = (char *)ptr - HEADER_SIZE;
+        track_in_use(0, get_block_size(ptr));
         *(block_header *)ptr |= 1UL; // update status to free
+        if (ptr != top) {
+            free_limit = SIZE_MAX;
+        }
+    }
+}
+
+/* Function: mymalloc_batch
+ * ------------------------
+ * This function allocates the blocks one at a time with mymalloc.
+ */
+size_t mymalloc_batch(size_t size, size_t n, void *out[]) {
+    size_t done = 0;
+    while (done < n && (out[done] = mymalloc(size)) != NULL) {
+        done++;
+    }
+    return done;
+}
+
+/* Function: myfree_batch
+ * ----------------------
+ * This function frees the blocks one at a time with myfree. Freed blocks are only
+ * merged when a later search or realloc reaches them, so there is nothing to gain
+ * from freeing neighbors together.
+ */
+void myfree_batch(void *ptrs[], size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        myfree(ptrs[i]);
     }
 }
 
+/* Function: myfree_sized
+ * ----------------------
+ * This function frees the block with myfree. Every block has the same layout, and
+ * freeing one means setting the status bit in its header, so the size is no help.
+ */
+void myfree_sized(void *ptr, size_t size) {
+    myfree(ptr);
+}
+
+/* Function: myusable_size
+ * -----------------------
+ * This function returns the payload size in the block's header, which includes any
+ * excess too small to have been split off as a free block.
+ */
+size_t myusable_size(void *ptr) {
+    return ptr != NULL ? get_block_size((char *)ptr - HEADER_SIZE) : 0;
+}
+
 /* Function: myrealloc
  * -------------------
- * This function reallocates previously used memory. It frees the previously allocated
- * memory and returns the new location of the allocation, accounting for the new size.
- * If the old pointer doesn't exist, the function returns the malloc of the new request.
- * If the new requested size is 0, the function frees the memory at the location of the 
- * old pointer and returns NULL. Otherwise, it copies memory to a new location, frees the
- * old pointer, and returns the location of the new pointer.
+ * This function reallocates previously used memory. If the old pointer doesn't exist,
+ * the function returns the malloc of the new request. If the new requested size is 0,
+ * the function frees the memory at the location of the old pointer and returns NULL.
+ * Otherwise the block is resized in place when it can be: a shrinking block splits its
+ * tail off as a free block, and a growing block first absorbs the free blocks to its
+ * right. Only if that is not enough does it copy the data to a new location, free the
+ * old pointer, and return the location of the new pointer.
  */
 void *myrealloc(void *old_ptr, size_t new_size) {
-    void *new_ptr = mymalloc(new_size);
     if (old_ptr == NULL) {
-        return new_ptr;
+        return mymalloc(new_size);
     }
     if (new_size == 0) {
         myfree(old_ptr);
         return NULL;
     }
+    if (new_size > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+    size_t needed = roundup(new_size, ALIGNMENT);
+    curr = (block_header *)((char *)old_ptr - HEADER_SIZE);
+    size_t old_size = get_block_size(curr);
+    if (needed > old_size) {
+        coalesce(NULL);
+        // absorbed blocks count as in use, without a new peak, until this one is freed
+        in_use += get_block_size(curr) - old_size;
+    }
+    size_t block_size = get_block_size(curr);
+    if (block_size >= needed && place_block(needed)) {
+        track_in_use(get_block_size(curr), block_size);
+        // a tail split off may be merged with a free block after it
+        if (get_block_size(curr) < block_size) {
+            free_limit = SIZE_MAX;
+        }
+        return old_ptr;
+    }
+
+    void *new_ptr = mymalloc(new_size);
     if (new_ptr != NULL) {
-        memcpy(new_ptr, old_ptr, new_size);
+        // copy no more than the old block holds, memory past it may not be committed
+        memcpy(new_ptr, old_ptr, old_size < new_size ? old_size : new_size);
         myfree(old_ptr);
-        return new_ptr;
     }
-    return NULL;
+    return new_ptr;
+}
+
+/* Function: myaligned_alloc
+ * -------------------------
+ * This function satisfies an aligned allocation from a free block that can hold the
+ * payload at a multiple of the alignment, found with find_fit as in mymalloc, so it
+ * follows FIT_POLICY and the rover too. Any slack in front of the aligned payload is
+ * split off as a free block of its own.
+ */
+void *myaligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+    if (alignment <= ALIGNMENT) {
+        return mymalloc(size);
+    }
+    if (size == 0 || size > MAX_REQUEST_SIZE || alignment > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+    size_t needed = roundup(size, ALIGNMENT);
+    if (!find_fit(needed, alignment)) {
+        printf("Heap space exhausted.\n");
+        return NULL;
+    }
+    size_t slack = aligned_slack(alignment);
+    if (slack != 0) {
+        block_header *aligned_header = (block_header *)((char *)curr + slack);
+        if (!commit_to((char *)aligned_header + HEADER_SIZE)) {
+            return NULL;
+        }
+        *aligned_header = (get_block_size(curr) - slack) | 1UL;
+        *curr = (slack - HEADER_SIZE) | 1UL;
+        if (curr == top) {
+            top = aligned_header;
+        }
+        free_limit = SIZE_MAX;
+        curr = aligned_header;
+    }
+    return allocate_at_curr(needed);
+}
+
+/* Function: myposix_memalign
+ * --------------------------
+ * This function checks the alignment and hands the request to myaligned_alloc,
+ * reporting the outcome as posix_memalign does.
+ */
+int myposix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || 
+        alignment % sizeof(void *) != 0) {
+        return EINVAL;
+    }
+    void *ptr = myaligned_alloc(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+/* Function: myheapstats
+ * ---------------------
+ * This function returns the heap statistics. Only in_use and its peak are counted as
+ * blocks change hands; the free blocks are found by walking every header, so this
+ * takes time linear in the number of blocks. Free blocks are merged lazily, so a run
+ * of adjacent free headers is counted as the single block it will become, and the
+ * run reaching the end of the heap is its top.
+ */
+heapstats_t myheapstats(void) {
+    heapstats_t stats = { .in_use = in_use, .peak_in_use = peak_in_use, 
+        .calloc_bytes = calloc_bytes, .calloc_written = calloc_bytes };
+    size_t run = 0;
+    bool in_run = false;
+    void *run_start = NULL;
+    for (block_header *header = segment_start; (void *)header != heap_end; 
+         header = (block_header *)((char *)header + get_block_size(header) + HEADER_SIZE)) {
+        if ((*header & 1UL) == 0) {
+            if (in_run) {
+                stats.free += run;
+                stats.free_blocks++;
+                stats.largest_free = run > stats.largest_free ? run : stats.largest_free;
+                in_run = false;
+            }
+        } else if (in_run) {
+            run += HEADER_SIZE + get_block_size(header);
+        } else {
+            run = get_block_size(header);
+            run_start = header;
+            in_run = true;
+        }
+    }
+    stats.heap_extent = (char *)(in_run ? run_start : heap_end) - (char *)segment_start;
+    stats.fragmentation = stats.free > 0 ? 1 - (double)stats.largest_free / stats.free : 0;
+    return stats;
 }
 
 /* Function validate_heap
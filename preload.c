@@ -0,0 +1,211 @@
+/* File: preload.c
+ * ---------------
+ * Exports the explicit allocator under the standard malloc family names, so
+ * that once built as a shared library it can replace the system allocator in
+ * any dynamically linked program:
+ *
+ *     LD_PRELOAD=./libexplicit.so <program> [args...]
+ *
+ * The library is built from the thread-safe explicit allocator with 16-byte
+ * payload alignment, as the x86-64 ABI requires of malloc. The heap segment is
+ * reserved on the first call, from whichever thread makes it. Nothing on that
+ * path allocates, so a call made while the heap is being set up cannot come
+ * back in here. Every pointer passed to free and realloc must have come from
+ * this library, which is the case once it is preloaded.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "allocator.h"
+#include "segment.h"
+
+// marks the entry points the library exports; it is built with -fvisibility=hidden,
+// so the allocator's own functions stay internal and a program's functions of the
+// same names cannot take their place
+#define EXPORT __attribute__((visibility("default")))
+
+// size of the heap segment reserved for the process
+#define PRELOAD_HEAP_SIZE (1L << 32)
+
+static pthread_once_t heap_once = PTHREAD_ONCE_INIT;
+// set once the heap is ready, so free can tell a heap exists without initializing one
+static bool heap_ready;
+
+/* Function: init_heap
+ * -------------------
+ * Reserves the heap segment and initializes the allocator over it, aborting
+ * if either fails, since there is no other allocator to fall back on.
+ */
+static void init_heap(void) {
+    void *start = init_heap_segment(PRELOAD_HEAP_SIZE);
+    if (start == NULL || !myinit(start, heap_segment_size())) {
+        abort();
+    }
+    __atomic_store_n(&heap_ready, true, __ATOMIC_RELEASE);
+}
+
+/* Function: ensure_heap
+ * ---------------------
+ * Initializes the heap on the first call of any thread; later calls cost one
+ * check of the once flag.
+ */
+static void ensure_heap(void) {
+    pthread_once(&heap_once, init_heap);
+}
+
+/* Function: heap_exists
+ * ----------------------
+ * Returns whether the heap has been set up. Before then no block can have come
+ * from this library, so any pointer passed in belongs to some other allocator,
+ * such as one a loader or dlsym bootstrap used before this library took over.
+ */
+static bool heap_exists(void) {
+    return __atomic_load_n(&heap_ready, __ATOMIC_ACQUIRE);
+}
+
+/* Function: nomem
+ * ---------------
+ * Returns ptr, setting errno to ENOMEM first if it is NULL, as the C library
+ * allocation functions do.
+ */
+static void *nomem(void *ptr) {
+    if (ptr == NULL) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+/* Function: malloc
+ * ----------------
+ * A zero-byte request gets a minimal block rather than NULL, as glibc's does,
+ * since some programs take NULL to mean memory ran out.
+ */
+EXPORT void *malloc(size_t size) {
+    ensure_heap();
+    return nomem(mymalloc(size != 0 ? size : 1));
+}
+
+/* Function: free
+ * --------------
+ * Freeing NULL does nothing, and a pointer freed before the heap exists, which
+ * cannot be one of ours, is leaked rather than handed to myfree.
+ */
+EXPORT void free(void *ptr) {
+    if (ptr != NULL && heap_exists()) {
+        myfree(ptr);
+    }
+}
+
+/* Function: free_sized
+ * --------------------
+ * The C23 free for callers that know the block's size, which spares a large
+ * block the lookups that tell a slab slot from a heap block. Like free, it leaks
+ * a pointer passed in before the heap exists.
+ */
+EXPORT void free_sized(void *ptr, size_t size) {
+    if (ptr != NULL && heap_exists()) {
+        myfree_sized(ptr, size);
+    }
+}
+
+/* Function: realloc
+ * -----------------
+ * A NULL pointer is a malloc and a zero size a free, returning NULL. On
+ * failure the old block is left as it was. A pointer passed in before the heap
+ * exists cannot be resized or copied, as its size is unknown, so it fails with
+ * ENOMEM and the block is leaked.
+ */
+EXPORT void *realloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return malloc(size);
+    }
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    if (!heap_exists()) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return nomem(myrealloc(ptr, size));
+}
+
+/* Function: calloc
+ * ----------------
+ * Fails if nmemb * size overflows. mycalloc only zeroes the parts of the block
+ * that may have been used before. Like malloc, a zero-byte request gets a
+ * minimal block.
+ */
+EXPORT void *calloc(size_t nmemb, size_t size) {
+    ensure_heap();
+    if (nmemb == 0 || size == 0) {
+        nmemb = size = 1;
+    }
+    return nomem(mycalloc(nmemb, size));
+}
+
+/* Function: aligned_alloc
+ * -----------------------
+ * The alignment must be a power of 2. Like malloc, a zero-byte request gets a
+ * minimal block.
+ */
+EXPORT void *aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    ensure_heap();
+    return nomem(myaligned_alloc(alignment, size != 0 ? size : 1));
+}
+
+/* Function: posix_memalign
+ * ------------------------
+ * The alignment must be a power of 2 and a multiple of sizeof(void *). Errors
+ * are returned rather than set in errno, and *memptr is only set on success.
+ */
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0 ||
+        alignment == 0) {
+        return EINVAL;
+    }
+    ensure_heap();
+    void *ptr = myaligned_alloc(alignment, size != 0 ? size : 1);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+/* Functions: memalign, valloc, pvalloc
+ * ------------------------------------
+ * Obsolete aligned allocators, exported too so that no block the program
+ * frees can have come from the system allocator.
+ */
+EXPORT void *memalign(size_t alignment, size_t size) {
+    return aligned_alloc(alignment, size);
+}
+
+EXPORT void *valloc(size_t size) {
+    return aligned_alloc(sysconf(_SC_PAGESIZE), size);
+}
+
+EXPORT void *pvalloc(size_t size) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    return aligned_alloc(page_size, (size + page_size - 1) & ~(page_size - 1));
+}
+
+/* Function: malloc_usable_size
+ * ------------------------------
+ * Returns how many bytes of the block the program may use, at least what it
+ * asked for, or 0 for NULL or a pointer passed in before the heap exists.
+ */
+EXPORT size_t malloc_usable_size(void *ptr) {
+    if (!heap_exists()) {
+        return 0;
+    }
+    return myusable_size(ptr);
+}
@@ -0,0 +1,413 @@
+/* File: script.c
+ * --------------
+ * Reads allocator scripts, either as text or as compiled binary traces. Text
+ * scripts are parsed line by line; binary traces are mapped read-only and
+ * their records are used directly after a single validation pass. Streamed
+ * scripts are read by a background thread into two alternating chunk buffers.
+ */
+
+#include "script.h"
+#include <error.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "allocator.h"
+
+// Amount by which we resize ops when needed when reading in from file
+const int OPS_RESIZE_AMOUNT = 500;
+
+const int MAX_SCRIPT_LINE_LEN = 1024;
+
+/* Struct: script_stream
+ * ----------------------
+ * State shared by a stream's reader thread and its consumer. The reader fills
+ * buffers[0], buffers[1], buffers[0], ... and marks each ready; the consumer
+ * takes them in the same order and hands each back by clearing ready when it
+ * asks for the next. A chunk of 0 requests marks the end of the script. All
+ * fields after the buffers are guarded by lock.
+ */
+struct script_stream {
+    FILE *fp;
+    const char *path;
+    bool binary;
+    int num_ops;                // number of records in a binary trace's header
+    int num_ids;                // id bound from a binary trace's header
+    int ops_read;               // records of a binary trace read so far
+    int lineno;                 // lines of a text script read so far
+    request_t *buffers[2];
+    int counts[2];
+    bool ready[2];
+    int current;                // buffer held by the consumer, or -1
+    bool stop;                  // set to make the reader exit early
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+static bool read_line(char buffer[], size_t buffer_size, FILE *fp, int *pnread);
+static request_t parse_script_line(char *buffer, int lineno, const char *path);
+static bool valid_record(const request_t *r, int num_ids);
+static int fill_chunk(script_stream_t *stream, request_t *chunk);
+static void *read_stream(void *arg);
+
+
+request_t *read_text_script(const char *path, int *num_ops, int *num_ids) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        error(1, 0, "Could not open script file \"%s\".", path);
+    }
+
+    request_t *ops = NULL;
+    int lineno = 0;
+    int nallocated = 0;
+    int maxid = 0;
+    int i = 0;
+    char buffer[MAX_SCRIPT_LINE_LEN];
+
+    for (; read_line(buffer, sizeof(buffer), fp, &lineno); i++) {
+
+        // Resize ops if we need more space for lines
+        if (i == nallocated) {
+            nallocated += OPS_RESIZE_AMOUNT;
+            void *new_memory = realloc(ops, nallocated * sizeof(request_t));
+            if (!new_memory) {
+                free(ops);
+                error(1, 0, "Libc heap exhausted. Cannot continue.");
+            }
+            ops = new_memory;
+        }
+
+        ops[i] = parse_script_line(buffer, lineno, path);
+
+        if (request_last_id(&ops[i]) > maxid) {
+            maxid = request_last_id(&ops[i]);
+        }
+    }
+
+    fclose(fp);
+    *num_ops = i;
+    *num_ids = maxid + 1;
+    return ops;
+}
+
+const request_t *map_binary_trace(const char *path, int *num_ops, int *num_ids) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        error(1, 0, "Could not open script file \"%s\".", path);
+    }
+
+    // anything without the magic string at the start is not a binary trace
+    trace_header_t header;
+    if (read(fd, &header, sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    struct stat st;
+    size_t len = sizeof(header) + (size_t)header.num_ops * sizeof(request_t);
+    if (header.num_ops < 0 || header.num_ids < 0 || fstat(fd, &st) == -1 ||
+        (size_t)st.st_size != len) {
+        error(1, 0, "Binary trace '%s' is truncated or corrupt.", path);
+    }
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        error(1, 0, "Could not map binary trace '%s'.", path);
+    }
+    const request_t *ops = (const request_t *)((char *)map + sizeof(header));
+
+    // the records are not parsed, but one bad record must not corrupt the harness
+    for (int i = 0; i < header.num_ops; i++) {
+        if (!valid_record(&ops[i], header.num_ids)) {
+            error(1, 0, "Record %d of binary trace '%s' is malformed.", i, path);
+        }
+    }
+
+    *num_ops = header.num_ops;
+    *num_ids = header.num_ids;
+    return ops;
+}
+
+void unmap_binary_trace(const request_t *ops, int num_ops) {
+    munmap((char *)ops - sizeof(trace_header_t),
+        sizeof(trace_header_t) + (size_t)num_ops * sizeof(request_t));
+}
+
+bool write_binary_trace(FILE *fp, const request_t *ops, int num_ops, int num_ids) {
+    trace_header_t header = { .num_ops = num_ops, .num_ids = num_ids };
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    return fwrite(&header, sizeof(header), 1, fp) == 1 &&
+        fwrite(ops, sizeof(request_t), num_ops, fp) == (size_t)num_ops;
+}
+
+script_stream_t *open_script_stream(const char *path) {
+    script_stream_t *stream = calloc(1, sizeof(script_stream_t));
+    if (stream == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    stream->fp = fopen(path, "r");
+    if (stream->fp == NULL) {
+        error(1, 0, "Could not open script file \"%s\".", path);
+    }
+    stream->path = path;
+
+    trace_header_t header;
+    stream->binary = fread(&header, sizeof(header), 1, stream->fp) == 1 &&
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) == 0;
+    if (stream->binary) {
+        if (header.num_ops < 0 || header.num_ids < 0) {
+            error(1, 0, "Binary trace '%s' is truncated or corrupt.", path);
+        }
+        stream->num_ops = header.num_ops;
+        stream->num_ids = header.num_ids;
+    } else {
+        rewind(stream->fp);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        stream->buffers[i] = malloc(STREAM_CHUNK_OPS * sizeof(request_t));
+        if (stream->buffers[i] == NULL) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+    }
+    stream->current = -1;
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->changed, NULL);
+    if (pthread_create(&stream->reader, NULL, read_stream, stream) != 0) {
+        error(1, 0, "Could not start reader thread for \"%s\".", path);
+    }
+    return stream;
+}
+
+const request_t *next_script_chunk(script_stream_t *stream, int *num_ops) {
+    pthread_mutex_lock(&stream->lock);
+    int next = 0;
+    if (stream->current != -1) {
+        // hand the chunk the caller is done with back to the reader
+        stream->ready[stream->current] = false;
+        next = 1 - stream->current;
+        pthread_cond_broadcast(&stream->changed);
+    }
+    while (!stream->ready[next]) {
+        pthread_cond_wait(&stream->changed, &stream->lock);
+    }
+    stream->current = next;
+    *num_ops = stream->counts[next];
+    pthread_mutex_unlock(&stream->lock);
+    return *num_ops > 0 ? stream->buffers[next] : NULL;
+}
+
+void close_script_stream(script_stream_t *stream) {
+    pthread_mutex_lock(&stream->lock);
+    stream->stop = true;
+    pthread_cond_broadcast(&stream->changed);
+    pthread_mutex_unlock(&stream->lock);
+    pthread_join(stream->reader, NULL);
+
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->changed);
+    fclose(stream->fp);
+    free(stream->buffers[0]);
+    free(stream->buffers[1]);
+    free(stream);
+}
+
+/* Function: read_stream
+ * ---------------------
+ * Body of a stream's reader thread. Fills the two chunk buffers in turn,
+ * waiting for the consumer to hand each back before refilling it, until it
+ * has delivered the empty chunk that ends the script or is told to stop.
+ */
+static void *read_stream(void *arg) {
+    script_stream_t *stream = arg;
+    for (int b = 0; ; b = 1 - b) {
+        pthread_mutex_lock(&stream->lock);
+        while (stream->ready[b] && !stream->stop) {
+            pthread_cond_wait(&stream->changed, &stream->lock);
+        }
+        bool stop = stream->stop;
+        pthread_mutex_unlock(&stream->lock);
+        if (stop) {
+            return NULL;
+        }
+
+        int count = fill_chunk(stream, stream->buffers[b]);
+
+        pthread_mutex_lock(&stream->lock);
+        stream->counts[b] = count;
+        stream->ready[b] = true;
+        pthread_cond_broadcast(&stream->changed);
+        pthread_mutex_unlock(&stream->lock);
+        if (count == 0) {
+            return NULL;
+        }
+    }
+}
+
+/* Function: fill_chunk
+ * --------------------
+ * Reads and validates up to STREAM_CHUNK_OPS requests from the stream into
+ * chunk and returns how many were read, 0 at the end of the script. A binary
+ * trace must hold exactly the number of records its header gives, as when it
+ * is mapped whole; the bytes after the last one are checked as it is read.
+ */
+static int fill_chunk(script_stream_t *stream, request_t *chunk) {
+    if (stream->binary) {
+        int left = stream->num_ops - stream->ops_read;
+        int count = left < STREAM_CHUNK_OPS ? left : STREAM_CHUNK_OPS;
+        if (fread(chunk, sizeof(request_t), count, stream->fp) != (size_t)count ||
+            (count == left && fgetc(stream->fp) != EOF)) {
+            error(1, 0, "Binary trace '%s' is truncated or corrupt.", stream->path);
+        }
+        stream->ops_read += count;
+        for (int i = 0; i < count; i++) {
+            if (!valid_record(&chunk[i], stream->num_ids)) {
+                error(1, 0, "Binary trace '%s' has a malformed record.", stream->path);
+            }
+        }
+        return count;
+    }
+    char buffer[MAX_SCRIPT_LINE_LEN];
+    int count = 0;
+    while (count < STREAM_CHUNK_OPS &&
+        read_line(buffer, sizeof(buffer), stream->fp, &stream->lineno)) {
+        chunk[count++] = parse_script_line(buffer, stream->lineno, stream->path);
+    }
+    return count;
+}
+
+/* Function: valid_record
+ * ----------------------
+ * Returns whether a binary trace record is a well-formed request whose id is
+ * below num_ids, with an alignment in range if it is an aligned allocation and
+ * at least one block if it is a batch request, all of whose ids must be below
+ * num_ids.
+ */
+static bool valid_record(const request_t *r, int num_ids) {
+    bool batch = r->op == BATCH_ALLOC || r->op == BATCH_FREE;
+    return r->op >= ALLOC && r->op < NUM_REQUEST_TYPES && r->reserved == 0 && r->id >= 0 &&
+        request_last_id(r) < num_ids && r->size <= MAX_REQUEST_SIZE && 
+        (r->op != ALIGNED_ALLOC || (r->aux < 31 && 1L << r->aux >= ALIGNMENT && 
+        1L << r->aux <= MAX_REQUEST_SIZE)) && (!batch || r->aux > 0);
+}
+
+long request_last_id(const request_t *request) {
+    bool batch = request->op == BATCH_ALLOC || request->op == BATCH_FREE;
+    return batch ? (long)request->id + request->aux - 1 : request->id;
+}
+
+/* Function: read_line
+ * --------------------
+ * This function reads one line from the specified file and stores at most
+ * buffer_size characters from it in buffer, removing any trailing newline.
+ * It skips lines that are all-whitespace or that contain comments (begin with
+ * # as first non-whitespace character).  When reading a line, it increments the
+ * counter pointed to by `pnread` once for each line read/skipped. This function
+ * returns true if did read a valid line eventually, or false otherwise.
+ */
+static bool read_line(char buffer[], size_t buffer_size, FILE *fp,
+    int *pnread) {
+
+    while (true) {
+        if (fgets(buffer, buffer_size, fp) == NULL) {
+            return false;
+        }
+
+        (*pnread)++;
+
+        // remove any trailing newline
+        if (buffer[strlen(buffer)-1] == '\n') {
+            buffer[strlen(buffer)-1] ='\0';
+        }
+
+        /* Stop only if this line is not a comment line (comment lines start
+         * with # as first non-whitespace character)
+         */
+        char ch;
+        if (sscanf(buffer, " %c", &ch) == 1 && ch != '#') {
+            return true;
+        }
+    }
+}
+
+/* Function: parse_script_line
+ * ---------------------------
+ * This function parses the provided line from the script and returns info
+ * about it as a request_t object filled in with the type of the request,
+ * the size, the ID, the arena, alignment or block count, and the line number.
+ * If the line is malformed, this function throws an error.
+ */
+static request_t parse_script_line(char *buffer, int lineno, const char *path) {
+
+    request_t request = { .lineno = lineno, .op = 0, .size = 0};
+
+    char request_char = '\0';
+    long args[3];
+    int nargs = sscanf(buffer, " %c %ld %ld %ld", &request_char,
+        &args[0], &args[1], &args[2]) - 1;
+    long id = 0, size = 0, arena = 0, align = ALIGNMENT, count = 1;
+    if (request_char == 'a' && nargs == 2) {
+        request.op = ALLOC;
+        id = args[0], size = args[1];
+    } else if (request_char == 'r' && nargs == 2) {
+        request.op = REALLOC;
+        id = args[0], size = args[1];
+    } else if (request_char == 'f' && nargs == 1) {
+        request.op = FREE;
+        id = args[0];
+    } else if (request_char == 'b' && nargs == 3) {
+        request.op = ARENA_ALLOC;
+        id = args[0], size = args[1], arena = args[2];
+    } else if (request_char == 'n' && nargs == 1) {
+        request.op = ARENA_CREATE;
+        arena = args[0];
+    } else if (request_char == 'm' && nargs == 1) {
+        request.op = ARENA_MARK;
+        arena = args[0];
+    } else if (request_char == 'u' && nargs == 1) {
+        request.op = ARENA_RELEASE;
+        arena = args[0];
+    } else if (request_char == 'z' && nargs == 1) {
+        request.op = ARENA_RESET;
+        arena = args[0];
+    } else if (request_char == 'A' && nargs == 3) {
+        request.op = ALIGNED_ALLOC;
+        id = args[0], size = args[1], align = args[2];
+    } else if (request_char == 'c' && nargs == 2) {
+        request.op = CALLOC;
+        id = args[0], size = args[1];
+    } else if (request_char == 'F' && nargs == 1) {
+        request.op = SIZED_FREE;
+        id = args[0];
+    } else if (request_char == 'B' && nargs == 3) {
+        request.op = BATCH_ALLOC;
+        id = args[0], count = args[1], size = args[2];
+    } else if (request_char == 'X' && nargs == 2) {
+        request.op = BATCH_FREE;
+        id = args[0], count = args[1];
+    }
+
+    if (!request.op || id < 0 || id > INT32_MAX || size < 0 || size > MAX_REQUEST_SIZE ||
+        arena < 0 || arena > UINT16_MAX || align < ALIGNMENT || align > MAX_REQUEST_SIZE ||
+        (align & (align - 1)) != 0 || count < 1 || count > UINT16_MAX || 
+        id + count - 1 > INT32_MAX) {
+        error(1, 0, "Line %d of script file '%s' is malformed.",
+            lineno, path);
+    }
+    request.id = id;
+    request.size = size;
+    if (request.op == ALIGNED_ALLOC) {
+        request.aux = __builtin_ctzl(align);
+    } else if (request.op == BATCH_ALLOC || request.op == BATCH_FREE) {
+        request.aux = count;
+    } else {
+        request.aux = arena;
+    }
+
+    return request;
+}
@@ -0,0 +1,131 @@
+/* File: script.h
+ * --------------
+ * Interface for reading allocator scripts. A script is either a text file with
+ * one request per line (a <id> <size>, r <id> <size>, f <id>, or one of the
+ * arena requests n <arena>, b <id> <size> <arena>, m <arena>, u <arena> and
+ * z <arena>, which create an arena, allocate from it, mark it, release it to
+ * its latest mark and reset it, A <id> <size> <align>, an allocation aligned
+ * to a power of 2 of at least ALIGNMENT, c <id> <size>, a zeroed allocation,
+ * F <id>, a free that passes the block's size, or B <id> <n> <size> and
+ * X <id> <n>, which allocate and free the n blocks with consecutive ids from id
+ * in a single call) or a compiled
+ * binary trace: a trace_header_t followed by an array of fixed-width request_t
+ * records, which is mapped into memory and used as is, with no parsing. Either
+ * kind can also be streamed in fixed-size chunks, for scripts too large to hold
+ * in memory.
+ */
+
+#ifndef _SCRIPT_H_
+#define _SCRIPT_H_
+#include <stdbool.h> // for bool
+#include <stdint.h>  // for fixed-width integer types
+#include <stdio.h>   // for FILE
+
+
+// enum and struct for a single allocator request
+enum request_type {
+    ALLOC = 1,
+    FREE,
+    REALLOC,
+    ARENA_CREATE,
+    ARENA_ALLOC,
+    ARENA_MARK,
+    ARENA_RELEASE,
+    ARENA_RESET,
+    ALIGNED_ALLOC,
+    CALLOC,
+    SIZED_FREE,
+    BATCH_ALLOC,
+    BATCH_FREE,
+    NUM_REQUEST_TYPES   // one more than the last request type
+};
+typedef struct {
+    uint8_t op;         // type of request, an enum request_type
+    uint8_t reserved;   // always 0
+    uint16_t aux;       // arena of arena requests, log2 of the alignment of aligned
+                        // allocations, number of blocks of batch requests, else 0
+    int32_t id;         // id for free() to use later
+    uint32_t size;      // num bytes for alloc/realloc request
+    int32_t lineno;     // which line in the original text script
+} request_t;
+
+// header at the start of a binary trace, followed by num_ops request_t records
+typedef struct {
+    char magic[8];      // TRACE_MAGIC, which also identifies the format version
+    int32_t num_ops;    // number of requests
+    int32_t num_ids;    // one more than the largest block id
+} trace_header_t;
+
+// magic string that starts every binary trace
+#define TRACE_MAGIC "HEAPTRC1"
+
+// The binary format depends on these layouts; records are in host byte order
+_Static_assert(sizeof(request_t) == 16, "request_t must be a 16-byte record");
+_Static_assert(sizeof(trace_header_t) == 16, "trace_header_t must be 16 bytes");
+
+
+/* Function: request_last_id
+ * ---------------------------
+ * Returns the largest block id the request refers to: the last of a batch
+ * request's ids, or else its id.
+ */
+long request_last_id(const request_t *request);
+
+
+/* Function: read_text_script
+ * --------------------------
+ * Parses the text script at path and returns a malloc'ed array of its requests,
+ * storing their number in *num_ops and one more than the largest id in
+ * *num_ids. Exits with an error if the file can't be read or a line is
+ * malformed.
+ */
+request_t *read_text_script(const char *path, int *num_ops, int *num_ids);
+
+
+/* Functions: map_binary_trace, unmap_binary_trace
+ * -----------------------------------------------
+ * map_binary_trace maps the binary trace at path read-only and returns its
+ * requests, storing their number in *num_ops and its id count in *num_ids, or
+ * returns NULL if the file is not a binary trace. Exits with an error if the
+ * trace is truncated or holds an invalid record. unmap_binary_trace releases a
+ * trace mapped by map_binary_trace.
+ */
+const request_t *map_binary_trace(const char *path, int *num_ops, int *num_ids);
+void unmap_binary_trace(const request_t *ops, int num_ops);
+
+
+/* Type: script_stream_t
+ * ----------------------
+ * An open script being read in chunks. A reader thread fills one chunk buffer
+ * while the caller executes the other, so reading and validating the script
+ * overlaps with replaying it.
+ */
+typedef struct script_stream script_stream_t;
+
+// number of requests in each chunk of a streamed script
+#define STREAM_CHUNK_OPS 65536
+
+
+/* Functions: open_script_stream, next_script_chunk, close_script_stream
+ * ---------------------------------------------------------------------
+ * open_script_stream opens the text script or binary trace at path and starts
+ * reading it in the background, exiting with an error if it can't be opened.
+ * next_script_chunk returns the next chunk of at most STREAM_CHUNK_OPS
+ * requests, storing its length in *num_ops, or NULL once the script is used
+ * up; the chunk stays valid until the next call. Malformed requests are
+ * reported as the chunk holding them is read. close_script_stream stops the
+ * reader, even partway through the script, and frees the stream.
+ */
+script_stream_t *open_script_stream(const char *path);
+const request_t *next_script_chunk(script_stream_t *stream, int *num_ops);
+void close_script_stream(script_stream_t *stream);
+
+
+/* Function: write_binary_trace
+ * ----------------------------
+ * Writes the given requests to fp as a binary trace. Returns false if the
+ * write failed.
+ */
+bool write_binary_trace(FILE *fp, const request_t *ops, int num_ops, int num_ids);
+
+#endif
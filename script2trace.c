@@ -0,0 +1,32 @@
+/* File: script2trace.c
+ * --------------------
+ * Compiles a text allocator script into a binary trace, which the test harness
+ * maps into memory and replays without parsing. Line numbers from the text
+ * script are kept in the trace, so errors still point at the original lines.
+ *
+ * Usage: script2trace <input.script> <output.trace>
+ */
+
+#include <error.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "script.h"
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        error(1, 0, "Usage: %s <input.script> <output.trace>", argv[0]);
+    }
+
+    int num_ops, num_ids;
+    request_t *ops = read_text_script(argv[1], &num_ops, &num_ids);
+
+    FILE *fp = fopen(argv[2], "wb");
+    if (fp == NULL) {
+        error(1, 0, "Could not create trace file \"%s\".", argv[2]);
+    }
+    if (!write_binary_trace(fp, ops, num_ops, num_ids) || fclose(fp) != 0) {
+        error(1, 0, "Could not write trace file \"%s\".", argv[2]);
+    }
+    free(ops);
+    return 0;
+}
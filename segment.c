@@ -1,13 +1,17 @@
 /* File: segment.c
  * ---------------
  * Handles low-level storage underneath the heap allocator. It reserves
- * the large memory segment using the OS-level mmap facility.
+ * the large memory segment using the OS-level mmap facility. The segment
+ * is only reserved up front, with no access rights; the allocator commits
+ * pages as it needs them and may decommit them again to give the memory
+ * back to the OS.
  *
  * Written by jzelenski, updated Spring 2018
  */
 
 #include "segment.h"
 #include <assert.h>
+#include <stdint.h>
 #include <sys/mman.h>
 
 /* Place segment at fixed address, as default addresses are quite high
@@ -15,10 +19,21 @@
  */
 #define HEAP_START_HINT (void *)0x107000000L
 
+// granularity of commit and decommit
+#define PAGE_SIZE 4096
+
 // Static means these variables are only visible within this file
 static void *segment_start = NULL;
 static size_t segment_size = 0;
 
+/* One bit per page of the segment, set while the page is committed. The map
+ * is itself mmap'ed so the segment never depends on the libc heap.
+ */
+static uint64_t *commit_map = NULL;
+static size_t commit_map_size = 0;
+static size_t committed_bytes = 0;
+static size_t peak_committed_bytes = 0;
+
 void *heap_segment_start() {
     return segment_start;
 }
@@ -27,17 +42,112 @@ size_t heap_segment_size() {
     return segment_size;
 }
 
+size_t segment_committed_bytes() {
+    return committed_bytes;
+}
+
+size_t segment_peak_committed_bytes() {
+    return peak_committed_bytes;
+}
+
 void *init_heap_segment(size_t total_size) {
     // Discard any previous segment via munmap
     if (segment_start != NULL) {
-        if (munmap(segment_start, total_size) == -1) return NULL;
+        if (munmap(segment_start, segment_size) == -1) return NULL;
+        munmap(commit_map, commit_map_size);
         segment_start = NULL;
         segment_size = 0;
     }
     
-    // Re-initialize by reserving entire segment with mmap
-    segment_start = mmap(HEAP_START_HINT, total_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    // Re-initialize by reserving entire segment with mmap, inaccessible until committed
+    segment_start = mmap(HEAP_START_HINT, total_size, PROT_NONE, 
+        MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
     assert(segment_start != MAP_FAILED);
     segment_size = total_size;
+
+    size_t npages = (total_size + PAGE_SIZE - 1) / PAGE_SIZE;
+    commit_map_size = (npages + 63) / 64 * sizeof(uint64_t);
+    commit_map = mmap(NULL, commit_map_size, PROT_READ|PROT_WRITE, 
+        MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    assert(commit_map != MAP_FAILED);
+    committed_bytes = 0;
+    peak_committed_bytes = 0;
     return segment_start;
 }
+
+/* Function: is_committed
+ * ----------------------
+ * Returns whether the page with the given index within the segment is committed.
+ */
+static int is_committed(size_t page) {
+    return (commit_map[page / 64] >> (page % 64)) & 1;
+}
+
+/* Function: change_pages
+ * ----------------------
+ * Walks the pages [first, last) and applies the commit or decommit to each run
+ * of pages that are not already in the requested state, updating the page map
+ * and counters. Returns false if the OS refused a request.
+ */
+static bool change_pages(size_t first, size_t last, bool commit) {
+    size_t page = first;
+    while (page < last) {
+        // skip whole words of the map that are already in the requested state
+        if (page % 64 == 0 && page + 64 <= last 
+            && commit_map[page / 64] == (commit ? ~0UL : 0UL)) {
+            page += 64;
+            continue;
+        }
+        if (is_committed(page) == commit) {
+            page++;
+            continue;
+        }
+        size_t run_end = page + 1;
+        while (run_end < last && is_committed(run_end) != commit) {
+            run_end++;
+        }
+        char *addr = (char *)segment_start + page * PAGE_SIZE;
+        size_t len = (run_end - page) * PAGE_SIZE;
+        if (commit) {
+            if (mprotect(addr, len, PROT_READ|PROT_WRITE) == -1) return false;
+            committed_bytes += len;
+        } else {
+            // remapping releases the pages and leaves them zero-filled if recommitted
+            if (mmap(addr, len, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_FIXED, 
+                -1, 0) == MAP_FAILED) return false;
+            committed_bytes -= len;
+        }
+        for (size_t i = page; i < run_end; i++) {
+            commit_map[i / 64] ^= 1UL << (i % 64);
+        }
+        page = run_end;
+    }
+    if (committed_bytes > peak_committed_bytes) {
+        peak_committed_bytes = committed_bytes;
+    }
+    return true;
+}
+
+bool segment_commit(void *addr, size_t size) {
+    if (size == 0) return true;
+    size_t offset = (char *)addr - (char *)segment_start;
+    size_t first = offset / PAGE_SIZE;
+    size_t last = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+    return change_pages(first, last, true);
+}
+
+bool segment_decommit(void *addr, size_t size) {
+    size_t offset = (char *)addr - (char *)segment_start;
+    size_t first = (offset + PAGE_SIZE - 1) / PAGE_SIZE;
+    size_t last = (offset + size) / PAGE_SIZE;
+    return first >= last || change_pages(first, last, false);
+}
+
+bool segment_zero(void *addr, size_t size) {
+    size_t offset = (char *)addr - (char *)segment_start;
+    size_t first = (offset + PAGE_SIZE - 1) / PAGE_SIZE;
+    size_t last = (offset + size) / PAGE_SIZE;
+    // dropping private anonymous pages leaves them zero-filled on the next access
+    return first >= last || madvise((char *)segment_start + first * PAGE_SIZE, 
+        (last - first) * PAGE_SIZE, MADV_DONTNEED) == 0;
+}
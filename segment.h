@@ -6,17 +6,19 @@
 
 #ifndef _SEGMENT_H_
 #define _SEGMENT_H_
+#include <stdbool.h> // for bool
 #include <stddef.h> // for size_t
 
 
 /* Function: init_heap_segment
  * ---------------------------
- * This function is called to initialize the heap segment and allocate the
- * segment to hold total_size bytes. If init_heap_segment 
+ * This function is called to initialize the heap segment and reserve the
+ * address range for total_size bytes. If init_heap_segment 
  * is called again, it discards the current heap segment and re-configures. 
  * The function returns the base address of the heap segment if successful 
  * or NULL if the initialization failed. The base address of the heap segment 
  * is always aligned to start on a page boundary (page size is 4096 bytes).
+ * The reserved memory cannot be accessed until it is committed.
  */
 void *init_heap_segment(size_t total_size);
 
@@ -32,4 +34,39 @@ void *heap_segment_start();
 size_t heap_segment_size();
 
 
+/* Functions: segment_commit, segment_decommit
+ * -------------------------------------------
+ * segment_commit makes every page overlapping [addr, addr + size) readable
+ * and writable. Pages are zero-filled the first time they are committed, or
+ * after being decommitted.
+ * segment_decommit returns every page lying entirely within [addr, addr + size)
+ * to the OS and makes it inaccessible again; partial pages at either end stay
+ * committed. Both functions accept ranges that are already (partly) in the
+ * requested state, and return false if the OS refused the request.
+ */
+bool segment_commit(void *addr, size_t size);
+bool segment_decommit(void *addr, size_t size);
+
+
+/* Function: segment_zero
+ * ----------------------
+ * segment_zero zero-fills every page lying entirely within [addr, addr + size),
+ * which must be committed, by handing its contents back to the OS rather than
+ * writing to it. The pages stay committed and are faulted back in, zero-filled,
+ * when next touched; partial pages at either end are left as they are. Returns
+ * false if the OS refused the request.
+ */
+bool segment_zero(void *addr, size_t size);
+
+
+/* Functions: segment_committed_bytes, segment_peak_committed_bytes
+ * ----------------------------------------------------------------
+ * segment_committed_bytes returns how many bytes of the segment are currently
+ * committed, and segment_peak_committed_bytes the most that have been committed
+ * at once since the segment was initialized.
+ */
+size_t segment_committed_bytes();
+size_t segment_peak_committed_bytes();
+
+
 #endif
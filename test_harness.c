@@ -14,69 +14,194 @@
 
 #include <error.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 #include "allocator.h"
+#include "script.h"
 #include "segment.h"
 
 
 /* TYPE DECLARATIONS */
 
 
-// enum and struct for a single allocator request
-enum request_type {
-    ALLOC = 1,
-    FREE,
-    REALLOC
-};
+// struct for the latencies, in cycles, of each timed call of one request type
 typedef struct {
-    enum request_type op;   // type of request
-    int id;                 // id for free() to use later
-    size_t size;            // num bytes for alloc/realloc request
-    int lineno;             // which line in file
-} request_t;
+    uint64_t *cycles;
+    size_t count;
+    size_t capacity;
+} latencies_t;
+
+// struct for the latencies of one script's timed runs, indexed by request type
+typedef struct {
+    latencies_t calls[NUM_REQUEST_TYPES];
+} timing_t;
 
 // struct for facts about a single malloc'ed block
 typedef struct {
     void *ptr;
     size_t size;
+    int id;             // id of the block in the script
+    int left;           // entries of its children in the block index, or -1
+    int right;
+    bool in_arena;      // whether the block was allocated from an arena
 } block_t;
 
-// struct for info for one script file
+// struct for a mark set on an arena and how many of its blocks predate it
+typedef struct {
+    arena_mark_t mark;
+    int nblocks;
+} arena_point_t;
+
+// struct for an arena a script created, with its live blocks in allocation order
+typedef struct {
+    arena_t *arena;     // the arena, or NULL if the script has not created it
+    int *entries;       // entries in blocks of the arena's live blocks
+    int num_blocks;
+    int max_blocks;
+    arena_point_t *marks;   // marks still set, the latest last
+    int num_marks;
+    int max_marks;
+} script_arena_t;
+
+// struct for an open-addressing hash map from block id to entry in blocks
+typedef struct {
+    int *ids;           // id in each bucket, or -1 if the bucket is empty
+    int *entries;       // entry in blocks for the id in the same bucket
+    int capacity;       // number of buckets, a power of two
+    int count;          // number of ids in the map
+} id_map_t;
+
+// struct for info for one script file. A streamed script holds only the current
+// chunk of requests, and keeps only live blocks in blocks, found through id_map;
+// otherwise all requests are loaded and blocks is indexed directly by id
 typedef struct {
     char name[128];     // short name of script
-    request_t *ops;     // array of requests read from script
-    int num_ops;        // number of requests
-    int num_ids;        // number of distinct block ids
+    const char *path;   // path the script is streamed from, or NULL if loaded
+    script_stream_t *stream;    // stream open while a streamed script runs
+    const request_t *ops;   // array of requests read or mapped from script
+    bool mapped;        // whether ops is a mapped binary trace rather than malloc'ed
+    int num_ops;        // number of requests in ops
+    int next_op;        // index in ops of the next request to replay
+    long num_serviced;  // requests replayed so far in the current run
+    int num_ids;        // number of entries in use in blocks
+    int max_ids;        // number of entries allocated for blocks (streamed only)
     block_t *blocks;    // array of memory blocks malloc returns when executing
+    id_map_t id_map;    // entry in blocks for each live id (streamed only)
+    int free_entry;     // first unused entry in blocks, linked by left (streamed only)
+    int index_root;     // entry at the root of the block index, or -1 if it is empty
     size_t peak_size;   // total payload bytes at peak in-use
+    void *heap_end;     // topmost address used by the heap in the current run
+    size_t cur_size;    // payload bytes currently allocated
+    size_t cur_outside; // payload bytes in live blocks mapped outside the heap segment
+    size_t peak_used;   // most memory the heap used at once in the current run
+    timing_t *timing;   // where to record call latencies, or NULL if not timing
+    bool sampled;       // check only sampled positions of large payloads
+    uint64_t sample_state;  // random state choosing the sampled cache lines
+    script_arena_t *arenas; // arenas indexed by number, grown as they are created
+    int num_arenas;     // number of entries allocated for arenas
+    FILE *timeline;     // where to write heap samples as CSV, or NULL if not sampling
+    long sample_every;  // number of requests between heap samples
 } script_t;
 
-// Amount by which we resize ops when needed when reading in from file
-const int OPS_RESIZE_AMOUNT = 500;
-
-const int MAX_SCRIPT_LINE_LEN = 1024;
+// struct for one thread of a threaded replay and the script or shard it replays
+typedef struct {
+    script_t script;
+    timing_t timing;
+    pthread_t thread;
+    bool success;
+} replay_thread_t;
 
 const long HEAP_SIZE = 1L << 32;
 
+// Default number of untimed warmup runs and timed runs of each script in timing mode
+const int DEFAULT_WARMUP_RUNS = 1;
+const int DEFAULT_TIMED_RUNS = 3;
+
+// How long the cycle counter is measured against the clock to find its rate
+const long CALIBRATION_NSECS = 50000000;
+
+// Initial number of entries in a streamed script's block table and id map
+#define OPS_CHUNK_IDS 1024
+
+// In sampling mode, payloads are checked at both ends and at this many random
+// interior cache lines; payloads too small to be worth sampling are checked whole
+#define SAMPLED_LINES 4
+#define CACHE_LINE_SIZE 64
+
 
 /* FUNCTION PROTOTYPES */
 
 
-static int test_scripts(char *script_names[], int num_script_names, bool quiet);
-static bool read_line(char buffer[], size_t buffer_size, FILE *fp, int *pnread);
+static int test_scripts(char *script_names[], int num_script_names, bool quiet,
+    bool sampled, bool streamed, bool timed, int nwarmup, int nrepeats, 
+    long sample_every);
+static int test_threaded(char *script_names[], int num_script_names, int nthreads,
+    bool sampled);
 static script_t parse_script(const char *filename);
-static request_t parse_script_line(char *buffer, int i, int lineno, char *script_name);
+static script_t shard_script(const script_t *whole, int shard, int nshards);
+static void free_script(script_t *script);
+static script_t open_streamed_script(const char *path);
 static size_t eval_correctness(script_t *script, bool quiet, bool *success);
-static void *eval_malloc(int req, size_t requested_size, script_t *script, bool *failptr);
-static void *eval_realloc(int req, size_t requested_size, script_t *script, bool *failptr);
-static bool verify_block(void *ptr, size_t size, script_t *script, int lineno);
+static bool in_segment(void *ptr);
+static void reset_run(script_t *script);
+static size_t replay_script(script_t *script, bool quiet, bool *success);
+static bool replay_request(script_t *script, const request_t *request);
+static bool verify_live_payloads(script_t *script);
+static FILE *open_timeline(const script_t *script);
+static void write_heap_sample(script_t *script);
+static void check_heap_block(script_t *script, const request_t *request);
+static script_arena_t *find_arena(script_t *script, const request_t *request, bool create);
+static bool eval_arena_create(const request_t *request, script_t *script);
+static void *eval_arena_alloc(const request_t *request, script_t *script, bool *failptr);
+static void eval_arena_mark(const request_t *request, script_t *script);
+static bool eval_arena_release(const request_t *request, script_t *script, 
+    size_t *released);
+static const request_t *next_request(script_t *script);
+static void *eval_malloc(const request_t *request, script_t *script, bool *failptr);
+static void *eval_realloc(const request_t *request, script_t *script, bool *failptr);
+static bool eval_malloc_batch(const request_t *request, script_t *script);
+static bool eval_free_batch(const request_t *request, script_t *script);
+static bool verify_block(void *ptr, size_t size, size_t alignment, script_t *script, 
+    int lineno);
+static bool verify_usable_size(void *ptr, size_t size, script_t *script, int lineno);
+static uint64_t index_priority(int entry);
+static int index_insert(script_t *script, int root, int entry);
+static int index_merge(script_t *script, int a, int b);
+static int index_remove(script_t *script, int root, int entry);
+static int index_find(script_t *script, void *addr);
+static void reset_blocks(script_t *script);
+static int find_block(script_t *script, int id, bool create);
+static void release_block(script_t *script, int entry);
+static int id_map_bucket(id_map_t *map, int id);
+static void id_map_put(id_map_t *map, int id, int entry);
+static void id_map_remove(id_map_t *map, int id);
+static void index_add_block(script_t *script, int entry);
+static void index_remove_block(script_t *script, int entry);
 static bool verify_payload(void *ptr, size_t size, int id, script_t *script, int lineno, char *op);
+static bool check_bytes(const unsigned char *p, size_t size, unsigned char byte);
+static uint64_t next_sample(script_t *script);
 static void allocator_error(script_t *script, int lineno, char* format, ...);
+static bool replay_round_robin(replay_thread_t *threads, int nthreads);
+static bool replay_concurrently(replay_thread_t *threads, int nthreads, double *secs);
+static void *run_replay_thread(void *arg);
+static size_t combined_extent(replay_thread_t *threads, int nthreads);
+static uint64_t read_cycles(void);
+static double cycles_per_second(void);
+static void record_latency(script_t *script, enum request_type op, uint64_t start);
+static void init_timing(timing_t *timing);
+static int compare_cycles(const void *a, const void *b);
+static void print_timing(timing_t *timing, double cycle_rate);
+static void free_timing(timing_t *timing);
 
 
 /* CORRECTNESS EVALUATION IMPLEMENTATION */
@@ -84,20 +209,53 @@ static void allocator_error(script_t *script, int lineno, char* format, ...);
 
 /* Function: main
  * --------------
- * The main function parses command-line arguments (currently only -q for quiet)
- * and any script files that follow and runs the heap allocator on the specified
- * script files.  It outputs statistics about the run of each script, such as
- * the number of successful runs, number of failures, and average utilization.
+ * The main function parses command-line arguments (-q for quiet, -s to sample
+ * payloads, -S to stream scripts, -t for timing mode, -w and -r for its number of warmup and timed
+ * runs, -T for threaded replay on the given number of threads, -c to write a heap
+ * timeline sampled every given number of requests) and any script files
+ * that follow and runs the heap allocator on the specified script files.  It
+ * outputs statistics about the run of each script, such as the number of
+ * successful runs, number of failures, and average utilization.
  */
 int main(int argc, char *argv[]) {
     // Parse command line arguments
     char c;
     bool quiet = false;
-    while ((c = getopt(argc, argv, "q")) != EOF) {
+    bool sampled = false;
+    bool streamed = false;
+    bool timed = false;
+    int nwarmup = DEFAULT_WARMUP_RUNS;
+    int nrepeats = DEFAULT_TIMED_RUNS;
+    int nthreads = 0;
+    long sample_every = 0;
+    while ((c = getopt(argc, argv, "qsStT:w:r:c:")) != EOF) {
         if (c == 'q') {
             quiet = true;
+        } else if (c == 's') {
+            sampled = true;
+        } else if (c == 'S') {
+            streamed = true;
+        } else if (c == 't') {
+            timed = true;
+        } else if (c == 'T') {
+            nthreads = atoi(optarg);
+            if (nthreads < 1) {
+                error(1, 0, "Threaded replay needs at least 1 thread.");
+            }
+        } else if (c == 'w') {
+            nwarmup = atoi(optarg);
+        } else if (c == 'r') {
+            nrepeats = atoi(optarg);
+        } else if (c == 'c') {
+            sample_every = atol(optarg);
+            if (sample_every < 1) {
+                error(1, 0, "Heap samples need to be at least 1 request apart.");
+            }
         }
     }
+    if (nwarmup < 0 || nrepeats < 1) {
+        error(1, 0, "Need at least 0 warmup runs and 1 timed run.");
+    }
     if (optind >= argc) {
         error(1, 0, "Missing argument. Please supply one or more script files.");
     }
@@ -105,42 +263,101 @@ int main(int argc, char *argv[]) {
     // disable stdout buffering, all printfs display to terminal immediately
     setvbuf(stdout, NULL, _IONBF, 0);
     
-    return test_scripts(argv + optind, argc - optind, quiet);
+    if (nthreads > 0) {
+        if (streamed) {
+            error(1, 0, "Threaded replay needs scripts loaded up front, not streamed.");
+        }
+        if (sample_every > 0) {
+            error(1, 0, "Heap timelines need a single-threaded replay.");
+        }
+        if (nthreads > 1 && !allocator_thread_safe) {
+            error(1, 0, "Replay on more than 1 thread needs a thread-safe allocator, "
+                "such as test_explicit_mt.");
+        }
+        return test_threaded(argv + optind, argc - optind, nthreads, sampled);
+    }
+    return test_scripts(argv + optind, argc - optind, quiet, sampled, streamed, 
+        timed, nwarmup, nrepeats, sample_every);
 }
 
 /* Function: test_scripts
  * ----------------------
  * Runs the scripts with names in the specified array, with more or less output
- * depending on the value of `quiet`.  Returns the number of failures during all
- * the tests.
+ * depending on the value of `quiet`.  If `sampled` is set, large payloads are
+ * only checked at sampled positions.  If `streamed` is set, scripts are read
+ * in chunks as they run instead of being loaded first.  If `timed` is set, each script is first
+ * run nwarmup times untimed and then nrepeats times with every allocator call
+ * timed, and the latencies of those calls are reported per request type.
+ * If sample_every is positive, the first run of each script writes a timeline
+ * of the heap, sampled every sample_every requests, to a CSV file named after
+ * the script; it is left out of the timed runs, since sampling may walk the heap.
+ * Returns the number of failures during all the tests.
  */
-static int test_scripts(char *script_names[], int num_script_names, bool quiet) {
+static int test_scripts(char *script_names[], int num_script_names, bool quiet,
+    bool sampled, bool streamed, bool timed, int nwarmup, int nrepeats, 
+    long sample_every) {
     int nsuccesses = 0;
     int nfailures = 0;
+    double cycle_rate = timed ? cycles_per_second() : 0;
 
     // Utilization summed across all successful script runs (each is % out of 100)
     int total_util = 0;
 
     for (int i = 0; i < num_script_names; i++) {
-        script_t script = parse_script(script_names[i]);
+        script_t script = streamed ? open_streamed_script(script_names[i]) : 
+            parse_script(script_names[i]);
+        script.sampled = sampled;
+        script.sample_state = 0x9E3779B97F4A7C15UL;
 
         // Evaluate this script and record the results
         printf("\nEvaluating allocator on %s...", script.name);
-        bool success;
-        size_t used_segment = eval_correctness(&script, quiet, &success);
+        bool success = true;
+        size_t used_segment = 0;
+        timing_t timing;
+        if (timed) {
+            init_timing(&timing);
+        }
+        int nruns = timed ? nwarmup + nrepeats : 1;
+        if (sample_every > 0) {
+            script.timeline = open_timeline(&script);
+            script.sample_every = sample_every;
+            // the timeline needs a run of its own if every run is timed
+            nruns += timed && nwarmup == 0;
+        }
+        for (int run = 0; run < nruns && success; run++) {
+            script.timing = timed && run >= nruns - nrepeats ? &timing : NULL;
+            used_segment = eval_correctness(&script, quiet, &success);
+            if (script.timeline != NULL) {
+                if (fclose(script.timeline) != 0) {
+                    error(1, 0, "Could not write the heap timeline of '%s'.", script.name);
+                }
+                script.timeline = NULL;
+            }
+        }
         if (success) {
-            printf("successfully serviced %d requests. (payload/segment = %zu/%zu)", 
-                script.num_ops, script.peak_size, used_segment);
+            printf("successfully serviced %ld requests. (payload/segment = %zu/%zu, "
+                "committed peak/end = %zu/%zu)", script.num_serviced, script.peak_size, 
+                used_segment, segment_peak_committed_bytes(), segment_committed_bytes());
+            heapstats_t stats = myheapstats();
+            if (stats.calloc_bytes > 0) {
+                printf(" (calloc wrote %zu of %zu bytes)", stats.calloc_written, 
+                    stats.calloc_bytes);
+            }
             if (used_segment > 0) {
                 total_util += (100 * script.peak_size) / used_segment;
             }
             nsuccesses++;
+            if (timed) {
+                print_timing(&timing, cycle_rate);
+            }
         } else {
             nfailures++;
         }
+        if (timed) {
+            free_timing(&timing);
+        }
 
-        free(script.ops);
-        free(script.blocks);
+        free_script(&script);
     }
 
     if (nsuccesses) {
@@ -153,10 +370,56 @@ static int test_scripts(char *script_names[], int num_script_names, bool quiet)
  * --------------------------
  * Check the allocator for correctness on given script. Interprets the
  * script operation-by-operation and reports if it detects any "obvious"
- * errors (returning blocks outside the heap, unaligned, 
- * overlapping blocks, etc.)
+ * errors (returning blocks straddling the heap, unaligned, 
+ * overlapping blocks, etc.)  A streamed script is opened for the run and
+ * closed again afterwards, even if the run stops early.
  */
 static size_t eval_correctness(script_t *script, bool quiet, bool *success) {
+    if (script->path != NULL) {
+        script->stream = open_script_stream(script->path);
+        script->ops = NULL;
+        script->num_ops = 0;
+    }
+    reset_run(script);
+
+    size_t used_segment = replay_script(script, quiet, success);
+
+    if (script->path != NULL) {
+        close_script_stream(script->stream);
+        script->stream = NULL;
+        script->ops = NULL;
+    }
+    return used_segment;
+}
+
+/* Function: reset_run
+ * -------------------
+ * Rewinds the script to its first request and clears everything recorded by
+ * the previous run, ready for a run against a fresh heap.
+ */
+static void reset_run(script_t *script) {
+    script->peak_size = 0;
+    script->num_serviced = 0;
+    script->next_op = 0;
+    script->heap_end = heap_segment_start();
+    script->cur_size = 0;
+    script->cur_outside = 0;
+    script->peak_used = 0;
+    reset_blocks(script);
+    for (int k = 0; k < script->num_arenas; k++) {
+        script->arenas[k].arena = NULL;
+        script->arenas[k].num_blocks = 0;
+        script->arenas[k].num_marks = 0;
+    }
+}
+
+/* Function: replay_script
+ * -----------------------
+ * Replays every request of the script against a fresh heap, checking the
+ * result of each, then checks the payloads of the blocks still live at the
+ * end.  Sets *success and returns the most memory the heap used at once.
+ */
+static size_t replay_script(script_t *script, bool quiet, bool *success) {
     *success = false;
     
     init_heap_segment(HEAP_SIZE);
@@ -164,102 +427,437 @@ static size_t eval_correctness(script_t *script, bool quiet, bool *success) {
         allocator_error(script, 0, "myinit() returned false");
         return -1;
     }
+    script->heap_end = heap_segment_start();
 
     if (!quiet && !validate_heap()) {
         allocator_error(script, 0, "validate_heap() after myinit returned false");
         return -1;
     }
 
-    // Track the topmost address used by the heap for utilization purposes
-    void *heap_end = heap_segment_start();
-
-    // Track the current amount of memory allocated on the heap
-    size_t cur_size = 0;
+    if (script->timeline != NULL) {
+        write_heap_sample(script);
+    }
 
     // Send each request to the heap allocator and check the resulting behavior
-    for (int req = 0; req < script->num_ops; req++) {
-        int id = script->ops[req].id;
-        size_t requested_size = script->ops[req].size;
-
-        if (script->ops[req].op == ALLOC) {
-            bool fail = false;
-            void *p = eval_malloc(req, requested_size, script, &fail);
-            if (fail) {
-                return -1;
-            }
-
-            cur_size += requested_size;
-            if ((char *)p + requested_size > (char *)heap_end) {
-                heap_end = (char *)p + requested_size;
-            }
-        } else if (script->ops[req].op == REALLOC) {
-            size_t old_size = script->blocks[id].size;
-            bool fail = false;
-            void *p = eval_realloc(req, requested_size, script, &fail);
-            if (fail) {
-                return -1;
-            }
-
-            cur_size += (requested_size - old_size);
-            if ((char *)p + requested_size > (char *)heap_end) {
-                heap_end = (char *)p + requested_size;
-            }
-        } else if (script->ops[req].op == FREE) {
-            size_t old_size = script->blocks[id].size;
-            void *p = script->blocks[id].ptr;
-
-            // verify payload intact before free
-            if (!verify_payload(p, old_size, id, script, 
-                script->ops[req].lineno, "freeing")) {
-                return -1;
-            }
-            script->blocks[id] = (block_t){.ptr = NULL, .size = 0};
-            myfree(p);
-            cur_size -= old_size;
+    const request_t *request;
+    while ((request = next_request(script)) != NULL) {
+        if (!replay_request(script, request)) {
+            return -1;
+        }
+        if (script->timeline != NULL && script->num_serviced % script->sample_every == 0) {
+            write_heap_sample(script);
         }
 
         // check heap consistency after each request and stop if any error
         if (!quiet && !validate_heap()) {
-            allocator_error(script, script->ops[req].lineno, 
+            allocator_error(script, request->lineno, 
                 "validate_heap() returned false, called in-between requests");
             return -1;
         }
+    }
+
+    if (script->timeline != NULL && script->num_serviced % script->sample_every != 0) {
+        write_heap_sample(script);
+    }
+    if (!verify_live_payloads(script)) {
+        return -1;
+    }
+    *success = true;
+    return script->peak_used;
+}
 
-        if (cur_size > script->peak_size) {
-            script->peak_size = cur_size;
+/* Function: open_timeline
+ * -----------------------
+ * Creates the CSV file for the script's heap timeline, named after the script
+ * with .csv appended and placed in the current directory, and writes its
+ * column names.  Exits with an error if the file can't be created.
+ */
+static FILE *open_timeline(const script_t *script) {
+    char path[sizeof(script->name) + 4];
+    snprintf(path, sizeof(path), "%s.csv", script->name);
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        error(1, 0, "Could not create heap timeline file \"%s\".", path);
+    }
+    fprintf(fp, "requests,payload,in_use,used,heap_extent,free,free_blocks,"
+        "largest_free,fragmentation,utilization\n");
+    return fp;
+}
+
+/* Function: write_heap_sample
+ * ---------------------------
+ * Appends one row to the script's heap timeline: the requests replayed so
+ * far, the live payload the script asked for, the memory used as utilization
+ * counts it (the heap's topmost address so far, plus live blocks mapped
+ * outside the segment), the allocator's own myheapstats figures, and the
+ * payload over the memory used.
+ */
+static void write_heap_sample(script_t *script) {
+    heapstats_t stats = myheapstats();
+    size_t used = (char *)script->heap_end - (char *)heap_segment_start() + 
+        script->cur_outside;
+    fprintf(script->timeline, "%ld,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%.4f,%.4f\n", 
+        script->num_serviced, script->cur_size, stats.in_use, used, stats.heap_extent, 
+        stats.free, stats.free_blocks, stats.largest_free, stats.fragmentation, 
+        used > 0 ? (double)script->cur_size / used : 0);
+}
+
+/* Function: replay_request
+ * ------------------------
+ * Sends one request of the script to the heap allocator and checks the
+ * result, keeping the script's live payload and heap extent up to date.
+ * Returns false if the allocator failed the request.
+ */
+static bool replay_request(script_t *script, const request_t *request) {
+    int id = request->id;
+    size_t requested_size = request->size;
+
+    if (request->op == ALLOC || request->op == ALIGNED_ALLOC || request->op == CALLOC || 
+        request->op == ARENA_ALLOC) {
+        check_heap_block(script, request);
+        bool fail = false;
+        void *p = request->op != ARENA_ALLOC ? eval_malloc(request, script, &fail) : 
+            eval_arena_alloc(request, script, &fail);
+        if (fail) {
+            return false;
+        }
+
+        script->cur_size += requested_size;
+        if (!in_segment(p)) {
+            script->cur_outside += requested_size;
+        } else if ((char *)p + requested_size > (char *)script->heap_end) {
+            script->heap_end = (char *)p + requested_size;
+        }
+    } else if (request->op == REALLOC) {
+        check_heap_block(script, request);
+        int entry = find_block(script, id, true);
+        size_t old_size = script->blocks[entry].size;
+        if (!in_segment(script->blocks[entry].ptr)) {
+            script->cur_outside -= old_size;
+        }
+        bool fail = false;
+        void *p = eval_realloc(request, script, &fail);
+        if (fail) {
+            return false;
+        }
+
+        script->cur_size += (requested_size - old_size);
+        if (!in_segment(p)) {
+            script->cur_outside += requested_size;
+        } else if ((char *)p + requested_size > (char *)script->heap_end) {
+            script->heap_end = (char *)p + requested_size;
+        }
+    } else if (request->op == FREE || request->op == SIZED_FREE) {
+        check_heap_block(script, request);
+        int entry = find_block(script, id, false);
+        size_t old_size = entry != -1 ? script->blocks[entry].size : 0;
+        void *p = entry != -1 ? script->blocks[entry].ptr : NULL;
+
+        // verify payload intact before free
+        if (!verify_payload(p, old_size, id, script, 
+            request->lineno, "freeing")) {
+            return false;
+        }
+        if (entry != -1) {
+            index_remove_block(script, entry);
+            release_block(script, entry);
+        }
+        if (request->op == SIZED_FREE && p != NULL && 
+            !verify_usable_size(p, old_size, script, request->lineno)) {
+            return false;
+        }
+        uint64_t start = read_cycles();
+        if (request->op == SIZED_FREE) {
+            myfree_sized(p, old_size);
+        } else {
+            myfree(p);
+        }
+        record_latency(script, request->op, start);
+        script->cur_size -= old_size;
+        if (!in_segment(p)) {
+            script->cur_outside -= old_size;
         }
+    } else if (request->op == BATCH_ALLOC) {
+        if (!eval_malloc_batch(request, script)) {
+            return false;
+        }
+    } else if (request->op == BATCH_FREE) {
+        if (!eval_free_batch(request, script)) {
+            return false;
+        }
+    } else if (request->op == ARENA_CREATE) {
+        if (!eval_arena_create(request, script)) {
+            return false;
+        }
+    } else if (request->op == ARENA_MARK) {
+        eval_arena_mark(request, script);
+    } else if (request->op == ARENA_RELEASE || request->op == ARENA_RESET) {
+        size_t released = 0;
+        if (!eval_arena_release(request, script, &released)) {
+            return false;
+        }
+        script->cur_size -= released;
     }
 
-    // verify payload is still intact for any block still allocated
-    for (int id = 0; id < script->num_ids; id++) {
-        if (!verify_payload(script->blocks[id].ptr, script->blocks[id].size, 
-            id, script, -1, "at exit")) {
-            return -1;
+    if (script->cur_size > script->peak_size) {
+        script->peak_size = script->cur_size;
+    }
+    // blocks mapped outside the heap segment count towards the memory used
+    // while they are live instead of towards heap_end
+    size_t used = (char *)script->heap_end - (char *)heap_segment_start() + 
+        script->cur_outside;
+    if (used > script->peak_used) {
+        script->peak_used = used;
+    }
+    return true;
+}
+
+/* Function: verify_live_payloads
+ * ------------------------------
+ * Verifies that the payload of every block still allocated at the end of a
+ * run is intact.
+ */
+static bool verify_live_payloads(script_t *script) {
+    for (int entry = 0; entry < script->num_ids; entry++) {
+        if (!verify_payload(script->blocks[entry].ptr, script->blocks[entry].size, 
+            script->blocks[entry].id, script, -1, "at exit")) {
+            return false;
         }
     }
+    return true;
+}
 
-    *success = true;
-    return (char *)heap_end - (char *)heap_segment_start();
+/* Function: check_heap_block
+ * ----------------------------
+ * Exits with an error if the request's id names a live block allocated from
+ * an arena, which the script may not free, realloc or allocate again.
+ */
+static void check_heap_block(script_t *script, const request_t *request) {
+    int entry = find_block(script, request->id, false);
+    if (entry != -1 && script->blocks[entry].in_arena) {
+        error(1, 0, "Line %d of script '%s' reuses block %d, which is in an arena.", 
+            request->lineno, script->name, request->id);
+    }
+}
+
+/* Function: find_arena
+ * --------------------
+ * Returns the script's record of the arena the request names.  If create is
+ * set the arena must not exist yet, and the table of arenas is grown to hold
+ * it; otherwise it must have been created.  Exits with an error if not.
+ */
+static script_arena_t *find_arena(script_t *script, const request_t *request, bool create) {
+    int k = request->aux;
+    if (create && k >= script->num_arenas) {
+        int num_arenas = k + 1 > 2 * script->num_arenas ? k + 1 : 2 * script->num_arenas;
+        script->arenas = realloc(script->arenas, num_arenas * sizeof(script_arena_t));
+        if (!script->arenas) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+        memset(script->arenas + script->num_arenas, 0, 
+            (num_arenas - script->num_arenas) * sizeof(script_arena_t));
+        script->num_arenas = num_arenas;
+    }
+    if (k >= script->num_arenas || (script->arenas[k].arena != NULL) == create) {
+        error(1, 0, "Line %d of script '%s' %s arena %d.", request->lineno, script->name,
+            create ? "creates existing" : "uses uncreated", k);
+    }
+    return &script->arenas[k];
+}
+
+/* Function: eval_arena_create
+ * ---------------------------
+ * Performs a test of a call to arena_create for the given request.  Returns
+ * false if the heap could not hold the new arena.
+ */
+static bool eval_arena_create(const request_t *request, script_t *script) {
+    script_arena_t *a = find_arena(script, request, true);
+    uint64_t start = read_cycles();
+    a->arena = arena_create(0);
+    record_latency(script, ARENA_CREATE, start);
+    if (a->arena == NULL) {
+        allocator_error(script, request->lineno, 
+            "heap exhausted, arena_create returned NULL");
+        return false;
+    }
+    return true;
+}
+
+/* Function: eval_arena_alloc
+ * --------------------------
+ * Performs a test of a call to arena_alloc for the given request, checking
+ * and filling in the new block as eval_malloc does, and records it as the
+ * arena's newest block.  Sets *failptr and returns NULL if the request fails.
+ */
+static void *eval_arena_alloc(const request_t *request, script_t *script, 
+    bool *failptr) {
+    script_arena_t *a = find_arena(script, request, false);
+    int id = request->id;
+    size_t requested_size = request->size;
+
+    uint64_t start = read_cycles();
+    void *p = arena_alloc(a->arena, requested_size);
+    record_latency(script, ARENA_ALLOC, start);
+    if (p == NULL && requested_size != 0) {
+        allocator_error(script, request->lineno, 
+            "heap exhausted, arena_alloc returned NULL");
+        *failptr = true;
+        return NULL;
+    }
+    if (!verify_block(p, requested_size, ALIGNMENT, script, request->lineno)) {
+        *failptr = true;
+        return NULL;
+    }
+
+    memset(p, id & 0xFF, requested_size);
+    if (p != NULL) {
+        int entry = find_block(script, id, true);
+        script->blocks[entry].ptr = p;
+        script->blocks[entry].size = requested_size;
+        script->blocks[entry].in_arena = true;
+        index_add_block(script, entry);
+        if (a->num_blocks == a->max_blocks) {
+            a->max_blocks = a->max_blocks ? 2 * a->max_blocks : OPS_CHUNK_IDS;
+            a->entries = realloc(a->entries, a->max_blocks * sizeof(int));
+            if (!a->entries) {
+                error(1, 0, "Libc heap exhausted. Cannot continue.");
+            }
+        }
+        a->entries[a->num_blocks++] = entry;
+    }
+    *failptr = false;
+    return p;
+}
+
+/* Function: eval_arena_mark
+ * -------------------------
+ * Performs a call to arena_mark for the given request and pushes the mark
+ * onto the arena's stack of marks.
+ */
+static void eval_arena_mark(const request_t *request, script_t *script) {
+    script_arena_t *a = find_arena(script, request, false);
+    if (a->num_marks == a->max_marks) {
+        a->max_marks = a->max_marks ? 2 * a->max_marks : 16;
+        a->marks = realloc(a->marks, a->max_marks * sizeof(arena_point_t));
+        if (!a->marks) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+    }
+    uint64_t start = read_cycles();
+    arena_mark_t mark = arena_mark(a->arena);
+    record_latency(script, ARENA_MARK, start);
+    a->marks[a->num_marks++] = (arena_point_t){ .mark = mark, .nblocks = a->num_blocks };
+}
+
+/* Function: eval_arena_release
+ * ----------------------------
+ * Performs a test of a call to arena_release_to_mark, releasing to the latest
+ * mark and popping it, or of arena_reset, for the given request.  The payload
+ * of every block released is checked first, and their total size is stored in
+ * *released.  Returns false if a payload was corrupted.
+ */
+static bool eval_arena_release(const request_t *request, script_t *script, 
+    size_t *released) {
+    script_arena_t *a = find_arena(script, request, false);
+    int keep = 0;
+    if (request->op == ARENA_RELEASE) {
+        if (a->num_marks == 0) {
+            error(1, 0, "Line %d of script '%s' releases arena %d, which has no mark.", 
+                request->lineno, script->name, request->aux);
+        }
+        keep = a->marks[a->num_marks - 1].nblocks;
+    }
+
+    *released = 0;
+    for (int i = keep; i < a->num_blocks; i++) {
+        block_t *block = &script->blocks[a->entries[i]];
+        if (!verify_payload(block->ptr, block->size, block->id, script, 
+            request->lineno, "releasing arena")) {
+            return false;
+        }
+        *released += block->size;
+        index_remove_block(script, a->entries[i]);
+        block->in_arena = false;
+        release_block(script, a->entries[i]);
+    }
+    a->num_blocks = keep;
+
+    uint64_t start = read_cycles();
+    if (request->op == ARENA_RELEASE) {
+        arena_release_to_mark(a->arena, a->marks[--a->num_marks].mark);
+        record_latency(script, ARENA_RELEASE, start);
+    } else {
+        arena_reset(a->arena);
+        record_latency(script, ARENA_RESET, start);
+        a->num_marks = 0;
+    }
+    return true;
+}
+
+/* Function: next_request
+ * -----------------------
+ * Returns the next request of the script to replay, or NULL at its end.  A
+ * streamed script moves on to its next chunk when the current one runs out.
+ */
+static const request_t *next_request(script_t *script) {
+    if (script->next_op == script->num_ops) {
+        if (script->stream == NULL) {
+            return NULL;
+        }
+        script->ops = next_script_chunk(script->stream, &script->num_ops);
+        script->next_op = 0;
+        if (script->ops == NULL) {
+            return NULL;
+        }
+    }
+    script->num_serviced++;
+    return &script->ops[script->next_op++];
+}
+
+/* Function: in_segment
+ * --------------------
+ * Returns whether the given block address lies within the heap segment. Blocks
+ * outside it were mapped separately by the allocator.
+ */
+static bool in_segment(void *ptr) {
+    return ptr >= heap_segment_start() && 
+        (char *)ptr < (char *)heap_segment_start() + heap_segment_size();
 }
 
 /* Function: eval_malloc
  * ---------------------
- * Performs a test of a call to mymalloc of the given size.  The req number
- * specifies the operation's index within the script.  This function verifies
+ * Performs a test of a call to mymalloc for the given request, or to
+ * myposix_memalign for an aligned allocation, whose alignment is 2 to the power
+ * of its aux field, or to mycalloc for a zeroed allocation, whose payload must
+ * then read as zero.  This function verifies
  * the entire malloc'ed block and fills in the payload with a low-order byte
  * of the request id.  If the request fails, the boolean pointed to by
  * failptr is set to true - otherwise, it is set to false.  If it is set to
  * true this function returns NULL; otherwise, it returns what was returned
  * by mymalloc.
  */
-static void *eval_malloc(int req, size_t requested_size, script_t *script, 
+static void *eval_malloc(const request_t *request, script_t *script, 
     bool *failptr) {
 
-    int id = script->ops[req].id;
+    int id = request->id;
+    size_t requested_size = request->size;
 
+    size_t alignment = request->op == ALIGNED_ALLOC ? (size_t)1 << request->aux : ALIGNMENT;
+
+    uint64_t start = read_cycles();
     void *p;
-    if ((p = mymalloc(requested_size)) == NULL && requested_size != 0) {
-        allocator_error(script, script->ops[req].lineno, 
+    if (request->op == ALIGNED_ALLOC) {
+        if (myposix_memalign(&p, alignment, requested_size) != 0) {
+            p = NULL;
+        }
+    } else if (request->op == CALLOC) {
+        p = mycalloc(1, requested_size);
+    } else {
+        p = mymalloc(requested_size);
+    }
+    record_latency(script, request->op, start);
+    if (p == NULL && requested_size != 0) {
+        allocator_error(script, request->lineno, 
             "heap exhausted, malloc returned NULL");
         *failptr = true;
         return NULL;
@@ -268,7 +866,18 @@ static void *eval_malloc(int req, size_t requested_size, script_t *script,
     /* Test new block for correctness: must be properly aligned
      * and must not overlap any currently allocated block.
      */
-    if (!verify_block(p, requested_size, script, script->ops[req].lineno)) {
+    if (!verify_block(p, requested_size, alignment, script, request->lineno)) {
+        *failptr = true;
+        return NULL;
+    }
+    if (request->op == CALLOC && !check_bytes(p, requested_size, 0)) {
+        // only a failed check needs the offset of the first bad byte
+        size_t i = 0;
+        while (((unsigned char *)p)[i] == 0) {
+            i++;
+        }
+        allocator_error(script, request->lineno, 
+            "calloc'ed block (%p) has nonzero byte at offset %zu", p, i);
         *failptr = true;
         return NULL;
     }
@@ -277,58 +886,169 @@ static void *eval_malloc(int req, size_t requested_size, script_t *script,
      * can be used later to verify data copied when realloc'ing.
      */
     memset(p, id & 0xFF, requested_size);
-    script->blocks[id] = (block_t){.ptr = p, .size = requested_size};
+    if (p != NULL) {
+        int entry = find_block(script, id, true);
+        script->blocks[entry].ptr = p;
+        script->blocks[entry].size = requested_size;
+        index_add_block(script, entry);
+    }
     *failptr = false;
     return p;
 }
 
+/* Function: eval_malloc_batch
+ * ---------------------------
+ * Performs a test of a call to mymalloc_batch for the given batch request, which
+ * allocates a block of the request's size for each of its aux ids from its id on.
+ * Each block is verified and filled in like one from eval_malloc, and the script's
+ * live payload and heap extent are updated.  Returns false if the request failed.
+ */
+static bool eval_malloc_batch(const request_t *request, script_t *script) {
+    int n = request->aux;
+    size_t requested_size = request->size;
+    request_t single = *request;
+    for (int i = 0; i < n; i++) {
+        single.id = request->id + i;
+        check_heap_block(script, &single);
+    }
+    void **ptrs = malloc(n * sizeof(void *));
+    if (!ptrs) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+
+    uint64_t start = read_cycles();
+    size_t count = mymalloc_batch(requested_size, n, ptrs);
+    record_latency(script, BATCH_ALLOC, start);
+    bool ok = true;
+    if (count < (size_t)n && requested_size != 0) {
+        allocator_error(script, request->lineno, 
+            "heap exhausted, malloc_batch returned %zu of %d blocks", count, n);
+        ok = false;
+    }
+    for (size_t i = 0; i < count && ok; i++) {
+        void *p = ptrs[i];
+        int id = request->id + i;
+        if (!verify_block(p, requested_size, ALIGNMENT, script, request->lineno)) {
+            ok = false;
+            break;
+        }
+        memset(p, id & 0xFF, requested_size);
+        int entry = find_block(script, id, true);
+        script->blocks[entry].ptr = p;
+        script->blocks[entry].size = requested_size;
+        index_add_block(script, entry);
+
+        script->cur_size += requested_size;
+        if (!in_segment(p)) {
+            script->cur_outside += requested_size;
+        } else if ((char *)p + requested_size > (char *)script->heap_end) {
+            script->heap_end = (char *)p + requested_size;
+        }
+    }
+    free(ptrs);
+    return ok;
+}
+
+/* Function: eval_free_batch
+ * -------------------------
+ * Performs a test of a call to myfree_batch for the given batch request, which
+ * frees the live blocks among its aux ids from its id on, after verifying that
+ * their payloads are intact.  Returns false if a payload was not.
+ */
+static bool eval_free_batch(const request_t *request, script_t *script) {
+    int n = request->aux;
+    void **ptrs = malloc(n * sizeof(void *));
+    if (!ptrs) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    size_t count = 0;
+    request_t single = *request;
+    for (int i = 0; i < n; i++) {
+        single.id = request->id + i;
+        check_heap_block(script, &single);
+        int entry = find_block(script, single.id, false);
+        if (entry == -1) {
+            continue;
+        }
+        void *p = script->blocks[entry].ptr;
+        size_t old_size = script->blocks[entry].size;
+        if (!verify_payload(p, old_size, single.id, script, request->lineno, "freeing")) {
+            free(ptrs);
+            return false;
+        }
+        index_remove_block(script, entry);
+        release_block(script, entry);
+        ptrs[count++] = p;
+        script->cur_size -= old_size;
+        if (!in_segment(p)) {
+            script->cur_outside -= old_size;
+        }
+    }
+
+    uint64_t start = read_cycles();
+    myfree_batch(ptrs, count);
+    record_latency(script, BATCH_FREE, start);
+    free(ptrs);
+    return true;
+}
+
 /* Function: eval_realloc
  * ---------------------
- * Performs a test of a call to myrealloc of the given size.  The req number
- * specifies the operation's index within the script.  This function verifies
+ * Performs a test of a call to myrealloc for the given request.  This function verifies
  * the entire realloc'ed block and fills in the payload with a low-order byte
  * of the request id.  If the request fails, the boolean pointed to by
  * failptr is set to true - otherwise, it is set to false.  If it is set to true
  * this function returns NULL; otherwise, it returns what was returned by
  * myrealloc.
  */
-static void *eval_realloc(int req, size_t requested_size, script_t *script, 
+static void *eval_realloc(const request_t *request, script_t *script, 
     bool *failptr) {
 
-    int id = script->ops[req].id;
-    size_t old_size = script->blocks[id].size;
+    int id = request->id;
+    size_t requested_size = request->size;
+    int entry = find_block(script, id, true);
+    size_t old_size = script->blocks[entry].size;
 
-    void *oldp = script->blocks[id].ptr;
+    void *oldp = script->blocks[entry].ptr;
     if (!verify_payload(oldp, old_size, id, script, 
-        script->ops[req].lineno, "pre-realloc-ing")) {
+        request->lineno, "pre-realloc-ing")) {
         *failptr = true;
         return NULL;
     }
 
-    void *newp;
-    if ((newp = myrealloc(oldp, requested_size)) == NULL && requested_size != 0) {
-        allocator_error(script, script->ops[req].lineno, 
+    uint64_t start = read_cycles();
+    void *newp = myrealloc(oldp, requested_size);
+    record_latency(script, REALLOC, start);
+    if (newp == NULL && requested_size != 0) {
+        allocator_error(script, request->lineno, 
             "heap exhausted, realloc returned NULL");
         *failptr = true;
         return NULL;
     }
 
-    script->blocks[id].size = 0;
-    if (!verify_block(newp, requested_size, script, script->ops[req].lineno)) {
+    index_remove_block(script, entry);
+    script->blocks[entry].size = 0;
+    if (!verify_block(newp, requested_size, ALIGNMENT, script, request->lineno)) {
         *failptr = true;
         return NULL;
     }
 
     // Verify new block contains the data from the old block
     if (!verify_payload(newp, (old_size < requested_size ? old_size : requested_size), 
-        id, script, script->ops[req].lineno, "post-realloc-ing (preserving data)")) {
+        id, script, request->lineno, "post-realloc-ing (preserving data)")) {
         *failptr = true;
         return NULL;
     }
 
     // Fill new block with the low-order byte of new id
     memset(newp, id & 0xFF, requested_size);
-    script->blocks[id] = (block_t){.ptr = newp, .size = requested_size};
+    script->blocks[entry].ptr = newp;
+    script->blocks[entry].size = requested_size;
+    if (newp != NULL) {
+        index_add_block(script, entry);
+    } else {
+        release_block(script, entry);
+    }
 
     *failptr = false;
     return newp;
@@ -340,15 +1060,19 @@ static void *eval_realloc(int req, size_t requested_size, script_t *script,
  * Does some checks on the block returned by allocator to try to
  * verify correctness.  If any problem shows up, reports an allocator error
  * with details and line from script file. The checks it performs are:
- *  -- verify block address is correctly aligned
- *  -- verify block address is within heap segment
+ *  -- verify block address is aligned to the given alignment
+ *  -- verify block is within heap segment or does not overlap it at all
  *  -- verify block address + size doesn't overlap any existing allocated block
+ * Existing blocks never overlap each other, so the only one the new block can
+ * overlap without overlapping a later one too is the last block starting before
+ * its end, which the block index finds in O(log n).
  */
-static bool verify_block(void *ptr, size_t size, script_t *script, int lineno) {
-    // address must be ALIGNMENT-byte aligned
-    if (((uintptr_t)ptr) % ALIGNMENT != 0) {
-        allocator_error(script, lineno, "New block (%p) not aligned to %d bytes",
-                        ptr, ALIGNMENT);
+static bool verify_block(void *ptr, size_t size, size_t alignment, script_t *script, 
+    int lineno) {
+    // address must be aligned as requested, at least to ALIGNMENT bytes
+    if (((uintptr_t)ptr) % alignment != 0) {
+        allocator_error(script, lineno, "New block (%p) not aligned to %zu bytes",
+                        ptr, alignment);
         return false;
     }
 
@@ -356,25 +1080,23 @@ static bool verify_block(void *ptr, size_t size, script_t *script, int lineno) {
         return true;
     }
 
-    // block must lie within the extent of the heap
+    // block must lie within the extent of the heap, or entirely outside it if the
+    // allocator mapped the block separately
     void *end = (char *)ptr + size;
     void *heap_end = (char *)heap_segment_start() + heap_segment_size();
-    if (ptr < heap_segment_start() || end > heap_end) {
-        allocator_error(script, lineno, "New block (%p:%p) not within heap segment (%p:%p)",
+    if ((ptr < heap_segment_start() && end > heap_segment_start()) ||
+        (ptr < heap_end && end > heap_end)) {
+        allocator_error(script, lineno, "New block (%p:%p) straddles heap segment (%p:%p)",
                         ptr, end, heap_segment_start(), heap_end);
         return false;
     }
 
     // block must not overlap any other blocks
-    for (int i = 0; i < script->num_ids; i++) {
-        if (script->blocks[i].ptr == NULL || script->blocks[i].size == 0) {
-            continue;
-        }
-
-        void *other_start = script->blocks[i].ptr;
-        void *other_end = (char *)other_start + script->blocks[i].size;
-        if ((ptr >= other_start && ptr < other_end) || (end > other_start && end < other_end) ||
-            (ptr < other_start && end >= other_end)) {
+    int other = index_find(script, size > 0 ? (char *)end - 1 : ptr);
+    if (other != -1) {
+        void *other_start = script->blocks[other].ptr;
+        void *other_end = (char *)other_start + script->blocks[other].size;
+        if (other_end > ptr) {
             allocator_error(script, lineno, "New block (%p:%p) overlaps existing block (%p:%p)",
                             ptr, end, other_start, other_end);
             return false;
@@ -384,25 +1106,387 @@ static bool verify_block(void *ptr, size_t size, script_t *script, int lineno) {
     return true;
 }
 
+/* Function: verify_usable_size
+ * -----------------------------
+ * Checks the usable size the allocator reports for a block of the given size
+ * that is about to be freed, and so is no longer in the block index. It must be
+ * at least the size, and the usable extent must not overlap any other block.
+ * The slack past the size is then written over, as a client growing into it
+ * would, so a later check notices if it was shared with anything else.
+ */
+static bool verify_usable_size(void *ptr, size_t size, script_t *script, int lineno) {
+    size_t usable = myusable_size(ptr);
+    if (usable < size) {
+        allocator_error(script, lineno, "Block (%p) of %zu bytes has usable size %zu",
+                        ptr, size, usable);
+        return false;
+    }
+    void *end = (char *)ptr + usable;
+    int other = index_find(script, usable > 0 ? (char *)end - 1 : ptr);
+    if (other != -1) {
+        void *other_start = script->blocks[other].ptr;
+        void *other_end = (char *)other_start + script->blocks[other].size;
+        if (other_end > ptr) {
+            allocator_error(script, lineno, "Usable extent of block (%p:%p) overlaps "
+                            "existing block (%p:%p)", ptr, end, other_start, other_end);
+            return false;
+        }
+    }
+    memset((char *)ptr + size, 0xA5, usable - size);
+    return true;
+}
+
+/* Function: index_priority
+ * --------------------------
+ * The block index is a treap of the live blocks ordered by start address, with
+ * child links stored in the blocks' entries so it needs no allocation. This
+ * returns a block's treap priority, a multiplicative hash of its entry.
+ */
+static uint64_t index_priority(int entry) {
+    return (uint64_t)entry * 0x9E3779B97F4A7C15UL;
+}
+
+/* Function: index_insert
+ * ----------------------
+ * Inserts the block at entry into the subtree with the given root as a leaf,
+ * then rotates it up while its priority beats its parent's.  Returns the new
+ * subtree root.
+ */
+static int index_insert(script_t *script, int root, int entry) {
+    block_t *blocks = script->blocks;
+    if (root == -1) {
+        blocks[entry].left = -1;
+        blocks[entry].right = -1;
+        return entry;
+    }
+    if (blocks[entry].ptr < blocks[root].ptr) {
+        blocks[root].left = index_insert(script, blocks[root].left, entry);
+        if (index_priority(blocks[root].left) > index_priority(root)) {
+            // rotate right
+            int child = blocks[root].left;
+            blocks[root].left = blocks[child].right;
+            blocks[child].right = root;
+            return child;
+        }
+    } else {
+        blocks[root].right = index_insert(script, blocks[root].right, entry);
+        if (index_priority(blocks[root].right) > index_priority(root)) {
+            // rotate left
+            int child = blocks[root].right;
+            blocks[root].right = blocks[child].left;
+            blocks[child].left = root;
+            return child;
+        }
+    }
+    return root;
+}
+
+/* Function: index_merge
+ * ---------------------
+ * Joins two subtrees where every block of a starts before every block of b,
+ * keeping the higher-priority root on top.  Returns the joined subtree's root.
+ */
+static int index_merge(script_t *script, int a, int b) {
+    if (a == -1) {
+        return b;
+    }
+    if (b == -1) {
+        return a;
+    }
+    if (index_priority(a) > index_priority(b)) {
+        script->blocks[a].right = index_merge(script, script->blocks[a].right, b);
+        return a;
+    }
+    script->blocks[b].left = index_merge(script, a, script->blocks[b].left);
+    return b;
+}
+
+/* Function: index_remove
+ * ----------------------
+ * Finds the block at entry by its start address and replaces it with the merge
+ * of its children.  Returns the new subtree root.
+ */
+static int index_remove(script_t *script, int root, int entry) {
+    block_t *blocks = script->blocks;
+    if (root == entry) {
+        return index_merge(script, blocks[entry].left, blocks[entry].right);
+    }
+    if (blocks[entry].ptr < blocks[root].ptr) {
+        blocks[root].left = index_remove(script, blocks[root].left, entry);
+    } else {
+        blocks[root].right = index_remove(script, blocks[root].right, entry);
+    }
+    return root;
+}
+
+/* Function: index_find
+ * --------------------
+ * Returns the entry of the live block with the highest start address at or below
+ * addr, or -1 if every live block starts above it.
+ */
+static int index_find(script_t *script, void *addr) {
+    int best = -1;
+    int cur = script->index_root;
+    while (cur != -1) {
+        if (script->blocks[cur].ptr <= addr) {
+            best = cur;
+            cur = script->blocks[cur].right;
+        } else {
+            cur = script->blocks[cur].left;
+        }
+    }
+    return best;
+}
+
+/* Functions: index_add_block, index_remove_block
+ * ----------------------------------------------
+ * Add the block at entry to the block index, or remove it, using the pointer
+ * and size currently recorded for it.  Empty blocks are never indexed.
+ */
+static void index_add_block(script_t *script, int entry) {
+    if (script->blocks[entry].ptr != NULL && script->blocks[entry].size != 0) {
+        script->index_root = index_insert(script, script->index_root, entry);
+    }
+}
+
+static void index_remove_block(script_t *script, int entry) {
+    if (script->blocks[entry].ptr != NULL && script->blocks[entry].size != 0) {
+        script->index_root = index_remove(script, script->index_root, entry);
+    }
+}
+
+/* Function: reset_blocks
+ * -----------------------
+ * Empties the block table and the block index before a run of the script.
+ */
+static void reset_blocks(script_t *script) {
+    script->index_root = -1;
+    if (script->path == NULL) {
+        memset(script->blocks, 0, script->num_ids * sizeof(block_t));
+        for (int id = 0; id < script->num_ids; id++) {
+            script->blocks[id].id = id;
+        }
+        return;
+    }
+    script->num_ids = 0;
+    script->free_entry = -1;
+    script->id_map.count = 0;
+    for (int i = 0; i < script->id_map.capacity; i++) {
+        script->id_map.ids[i] = -1;
+    }
+}
+
+/* Function: find_block
+ * --------------------
+ * Returns the entry in blocks for the given id.  A loaded script has an entry
+ * for every id.  A streamed script only has entries for live ids, so if the id
+ * has none, one is set up for it if create is set, or -1 is returned otherwise.
+ */
+static int find_block(script_t *script, int id, bool create) {
+    if (script->path == NULL) {
+        return id;
+    }
+    int bucket = id_map_bucket(&script->id_map, id);
+    if (bucket != -1 && script->id_map.ids[bucket] == id) {
+        return script->id_map.entries[bucket];
+    }
+    if (!create) {
+        return -1;
+    }
+
+    // reuse an entry freed earlier, or else grow the table
+    int entry = script->free_entry;
+    if (entry != -1) {
+        script->free_entry = script->blocks[entry].left;
+    } else {
+        if (script->num_ids == script->max_ids) {
+            script->max_ids = script->max_ids ? 2 * script->max_ids : OPS_CHUNK_IDS;
+            script->blocks = realloc(script->blocks, script->max_ids * sizeof(block_t));
+            if (!script->blocks) {
+                error(1, 0, "Libc heap exhausted. Cannot continue.");
+            }
+        }
+        entry = script->num_ids++;
+    }
+    script->blocks[entry] = (block_t){.ptr = NULL, .size = 0, .id = id, .in_arena = false};
+    id_map_put(&script->id_map, id, entry);
+    return entry;
+}
+
+/* Function: release_block
+ * -----------------------
+ * Marks the block at entry as no longer allocated.  In a streamed script the
+ * entry is also unmapped from its id and kept for reuse.
+ */
+static void release_block(script_t *script, int entry) {
+    script->blocks[entry].ptr = NULL;
+    script->blocks[entry].size = 0;
+    if (script->path != NULL) {
+        id_map_remove(&script->id_map, script->blocks[entry].id);
+        script->blocks[entry].left = script->free_entry;
+        script->free_entry = entry;
+    }
+}
+
+/* Function: id_map_bucket
+ * -----------------------
+ * Returns the bucket holding id, or else the empty bucket where id would go,
+ * probing linearly from a multiplicative hash of the id.  Returns -1 if the
+ * map has no buckets yet.
+ */
+static int id_map_bucket(id_map_t *map, int id) {
+    if (map->capacity == 0) {
+        return -1;
+    }
+    int mask = map->capacity - 1;
+    int bucket = (int)(((uint64_t)id * 0x9E3779B97F4A7C15UL) >> 32) & mask;
+    while (map->ids[bucket] != -1 && map->ids[bucket] != id) {
+        bucket = (bucket + 1) & mask;
+    }
+    return bucket;
+}
+
+/* Function: id_map_put
+ * --------------------
+ * Maps id, which must not be in the map, to entry.  The map doubles its buckets
+ * whenever it would become more than half full.
+ */
+static void id_map_put(id_map_t *map, int id, int entry) {
+    if (2 * (map->count + 1) > map->capacity) {
+        id_map_t old = *map;
+        map->capacity = old.capacity ? 2 * old.capacity : OPS_CHUNK_IDS;
+        map->ids = malloc(map->capacity * sizeof(int));
+        map->entries = malloc(map->capacity * sizeof(int));
+        if (!map->ids || !map->entries) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+        for (int i = 0; i < map->capacity; i++) {
+            map->ids[i] = -1;
+        }
+        map->count = 0;
+        for (int i = 0; i < old.capacity; i++) {
+            if (old.ids[i] != -1) {
+                id_map_put(map, old.ids[i], old.entries[i]);
+            }
+        }
+        free(old.ids);
+        free(old.entries);
+    }
+    int bucket = id_map_bucket(map, id);
+    map->ids[bucket] = id;
+    map->entries[bucket] = entry;
+    map->count++;
+}
+
+/* Function: id_map_remove
+ * -----------------------
+ * Removes id from the map.  The ids after it in its probe run are shifted back
+ * into the gap, so lookups never need tombstones.
+ */
+static void id_map_remove(id_map_t *map, int id) {
+    int mask = map->capacity - 1;
+    int gap = id_map_bucket(map, id);
+    map->ids[gap] = -1;
+    map->count--;
+    for (int i = (gap + 1) & mask; map->ids[i] != -1; i = (i + 1) & mask) {
+        int moved = map->ids[i];
+        int home = id_map_bucket(map, moved);
+        if (home != i) {
+            map->ids[home] = moved;
+            map->entries[home] = map->entries[i];
+            map->ids[i] = -1;
+        }
+    }
+}
+
 /* Function: verify_payload
  * ------------------------
  * When a block is allocated, the payload is filled with a simple repeating
  * pattern based on its id.  Check the payload to verify those contents are
- * still intact, otherwise raise allocator error.
+ * still intact, otherwise raise allocator error.  In sampling mode a large
+ * payload is only checked in its first and last cache lines and SAMPLED_LINES
+ * random cache lines in between.
  */
 static bool verify_payload(void *ptr, size_t size, int id, script_t *script, 
     int lineno, char *op) {
 
-    for (size_t i = 0; i < size; i++) {
-        if (*((unsigned char *)ptr + i) != (id & 0xFF)) {
-            allocator_error(script, lineno, 
-                "invalid payload data detected when %s address %p", op, ptr);
+    unsigned char *p = ptr;
+    bool intact;
+    if (!script->sampled || size <= (SAMPLED_LINES + 2) * CACHE_LINE_SIZE) {
+        intact = check_bytes(p, size, id & 0xFF);
+    } else {
+        intact = check_bytes(p, CACHE_LINE_SIZE, id & 0xFF) &&
+            check_bytes(p + size - CACHE_LINE_SIZE, CACHE_LINE_SIZE, id & 0xFF);
+        size_t ninterior = size / CACHE_LINE_SIZE - 1;
+        for (int i = 0; i < SAMPLED_LINES && intact; i++) {
+            size_t line = 1 + next_sample(script) % ninterior;
+            intact = check_bytes(p + line * CACHE_LINE_SIZE, CACHE_LINE_SIZE, id & 0xFF);
+        }
+    }
+    if (!intact) {
+        allocator_error(script, lineno, 
+            "invalid payload data detected when %s address %p", op, ptr);
+        return false;
+    }
+    return true;
+}
+
+/* Function: check_bytes
+ * ---------------------
+ * Returns whether all size bytes starting at p equal byte.  The bulk of the
+ * range is compared 16 bytes at a time with SSE2 on x86, or 8 bytes at a time
+ * as words elsewhere, with the unaligned ends checked byte by byte.
+ */
+static bool check_bytes(const unsigned char *p, size_t size, unsigned char byte) {
+    const unsigned char *end = p + size;
+#if defined(__x86_64__) || defined(__i386__)
+    const size_t width = sizeof(__m128i);
+#else
+    const size_t width = sizeof(uint64_t);
+#endif
+    while (p < end && (uintptr_t)p % width != 0) {
+        if (*p++ != byte) {
+            return false;
+        }
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __m128i pattern = _mm_set1_epi8((char)byte);
+    for (; p + width <= end; p += width) {
+        __m128i chunk = _mm_load_si128((const __m128i *)p);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern)) != 0xFFFF) {
+            return false;
+        }
+    }
+#else
+    uint64_t pattern = byte * 0x0101010101010101UL;
+    for (; p + width <= end; p += width) {
+        if (*(const uint64_t *)p != pattern) {
+            return false;
+        }
+    }
+#endif
+    while (p < end) {
+        if (*p++ != byte) {
             return false;
         }
     }
     return true;
 }
 
+/* Function: next_sample
+ * ---------------------
+ * Advances the script's xorshift generator and returns its next value, used to
+ * pick which cache lines of a payload to check in sampling mode.
+ */
+static uint64_t next_sample(script_t *script) {
+    uint64_t x = script->sample_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    script->sample_state = x;
+    return x;
+}
+
 /* Function: allocator_error
  * ------------------------
  * Report an error while running an allocator script.  Prints out the script
@@ -420,59 +1504,340 @@ static void allocator_error(script_t *script, int lineno, char* format, ...) {
 }
 
 
-/* SCRIPT PARSING IMPLEMENTATION */
+/* THREADED REPLAY IMPLEMENTATION */
 
 
-/* Fuction: parse_script
- * ---------------------
- * This function parses the script file at the specified path, and returns an
- * object with info about it.  It expects one request per line, and adds each
- * request's information to the ops array within the script.  This function
- * throws an error if the file can't be opened, if a line is malformed, or if
- * the file is too long to store each request on the heap.
+/* Function: test_threaded
+ * -----------------------
+ * Replays scripts on nthreads threads at once against one shared heap, which
+ * needs an allocator built to be thread-safe.  Given one script, thread i
+ * replays the shard of its requests whose ids are i mod nthreads; given
+ * several, there must be one per thread.  Each thread checks only its own
+ * blocks and payloads, and validate_heap is never called since other threads
+ * may be changing the heap.  The same requests are first replayed
+ * interleaved round-robin on this thread, as the single-threaded baseline for
+ * the heap extent.  Prints the total throughput, each thread's call latencies
+ * and the heap growth, and returns the number of failures.
  */
-static script_t parse_script(const char *path) {
-    FILE *fp = fopen(path, "r");
-    if (fp == NULL) {
-        error(1, 0, "Could not open script file \"%s\".", path);
+static int test_threaded(char *script_names[], int num_script_names, int nthreads,
+    bool sampled) {
+    if (num_script_names != 1 && num_script_names != nthreads) {
+        error(1, 0, "Threaded replay needs one script to shard or one script per thread.");
+    }
+    replay_thread_t *threads = calloc(nthreads, sizeof(replay_thread_t));
+    if (!threads) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    if (num_script_names == 1) {
+        script_t whole = parse_script(script_names[0]);
+        for (int i = 0; i < nthreads; i++) {
+            threads[i].script = shard_script(&whole, i, nthreads);
+        }
+        printf("\nReplaying %s as %d shards on %d threads...", whole.name, nthreads, 
+            nthreads);
+        free_script(&whole);
+    } else {
+        for (int i = 0; i < nthreads; i++) {
+            threads[i].script = parse_script(script_names[i]);
+        }
+        printf("\nReplaying %d scripts on %d threads...", nthreads, nthreads);
     }
+    for (int i = 0; i < nthreads; i++) {
+        threads[i].script.sampled = sampled;
+        threads[i].script.sample_state = 0x9E3779B97F4A7C15UL * (i + 1);
+        init_timing(&threads[i].timing);
+    }
+    double cycle_rate = cycles_per_second();
 
-    // Initialize a script object to store the information about this script
-    script_t script = { .ops = NULL, .blocks = NULL, .num_ops = 0, .peak_size = 0};
-    const char *basename = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
-    strncpy(script.name, basename, sizeof(script.name) - 1);
-    script.name[sizeof(script.name) - 1] = '\0';
+    int nfailures = 0;
+    double secs = 0;
+    size_t single_extent = 0, single_committed = 0;
+    if (!replay_round_robin(threads, nthreads)) {
+        nfailures++;
+    } else {
+        single_extent = combined_extent(threads, nthreads);
+        single_committed = segment_peak_committed_bytes();
+        if (!replay_concurrently(threads, nthreads, &secs)) {
+            nfailures++;
+        }
+    }
+
+    if (nfailures == 0) {
+        long total = 0;
+        for (int i = 0; i < nthreads; i++) {
+            printf("\n%s: %ld requests", threads[i].script.name, 
+                threads[i].script.num_serviced);
+            print_timing(&threads[i].timing, cycle_rate);
+            total += threads[i].script.num_serviced;
+        }
+        size_t extent = combined_extent(threads, nthreads);
+        printf("\n\nServiced %ld requests in %.3f s on %d threads (%.0f requests/sec)", 
+            total, secs, nthreads, total / secs);
+        printf("\nHeap extent %zu vs %zu single-threaded (%.2fx), committed peak %zu vs %zu\n",
+            extent, single_extent, single_extent ? (double)extent / single_extent : 0, 
+            segment_peak_committed_bytes(), single_committed);
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        free_timing(&threads[i].timing);
+        free_script(&threads[i].script);
+    }
+    free(threads);
+    return nfailures;
+}
 
-    int lineno = 0;
-    int nallocated = 0;
-    int maxid = 0;
-    char buffer[MAX_SCRIPT_LINE_LEN];
+/* Function: replay_round_robin
+ * ----------------------------
+ * Replays the requests of every thread's script against a fresh heap on this
+ * thread alone, taking one request from each script in turn, and checks the
+ * blocks still live at the end.  Returns false if the allocator failed.
+ */
+static bool replay_round_robin(replay_thread_t *threads, int nthreads) {
+    init_heap_segment(HEAP_SIZE);
+    if (!myinit(heap_segment_start(), heap_segment_size())) {
+        allocator_error(&threads[0].script, 0, "myinit() returned false");
+        return false;
+    }
+    for (int i = 0; i < nthreads; i++) {
+        reset_run(&threads[i].script);
+        threads[i].script.timing = NULL;
+    }
 
-    for (int i = 0; read_line(buffer, sizeof(buffer), fp, &lineno); i++) {
+    for (bool more = true; more; ) {
+        more = false;
+        for (int i = 0; i < nthreads; i++) {
+            const request_t *request = next_request(&threads[i].script);
+            if (request != NULL) {
+                if (!replay_request(&threads[i].script, request)) {
+                    return false;
+                }
+                more = true;
+            }
+        }
+    }
+    for (int i = 0; i < nthreads; i++) {
+        if (!verify_live_payloads(&threads[i].script)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Function: replay_concurrently
+ * -----------------------------
+ * Replays every thread's script against a fresh heap, each on its own thread
+ * and all at once, timing each call.  Stores the wall-clock time from starting
+ * the first thread to finishing the last in *secs.  Returns false if the
+ * allocator failed any thread's script.
+ */
+static bool replay_concurrently(replay_thread_t *threads, int nthreads, double *secs) {
+    init_heap_segment(HEAP_SIZE);
+    if (!myinit(heap_segment_start(), heap_segment_size())) {
+        allocator_error(&threads[0].script, 0, "myinit() returned false");
+        return false;
+    }
+    for (int i = 0; i < nthreads; i++) {
+        reset_run(&threads[i].script);
+        threads[i].script.timing = &threads[i].timing;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i].thread, NULL, run_replay_thread, &threads[i]) != 0) {
+            error(1, 0, "Could not start replay thread %d.", i);
+        }
+    }
+    bool success = true;
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        success &= threads[i].success;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return success;
+}
 
-        // Resize script->ops if we need more space for lines
-        if (i == nallocated) {
-            nallocated += OPS_RESIZE_AMOUNT;
-            void *new_memory = realloc(script.ops, 
-                nallocated * sizeof(request_t));
-            if (!new_memory) {
-                free(script.ops);
+/* Function: run_replay_thread
+ * ---------------------------
+ * Thread body for replay_concurrently: replays the thread's script, stopping
+ * at the first failed request, then checks the blocks still live at the end.
+ */
+static void *run_replay_thread(void *arg) {
+    replay_thread_t *t = arg;
+    t->success = false;
+    const request_t *request;
+    while ((request = next_request(&t->script)) != NULL) {
+        if (!replay_request(&t->script, request)) {
+            return NULL;
+        }
+    }
+    t->success = verify_live_payloads(&t->script);
+    return NULL;
+}
+
+/* Function: combined_extent
+ * -------------------------
+ * Returns the most memory the shared heap used in the last run: its extent up
+ * to the highest block any thread was given, plus each thread's peak use
+ * beyond its own extent, which was in blocks mapped outside the heap segment.
+ */
+static size_t combined_extent(replay_thread_t *threads, int nthreads) {
+    void *heap_end = heap_segment_start();
+    size_t outside = 0;
+    for (int i = 0; i < nthreads; i++) {
+        script_t *script = &threads[i].script;
+        size_t own_extent = (char *)script->heap_end - (char *)heap_segment_start();
+        if (script->heap_end > heap_end) {
+            heap_end = script->heap_end;
+        }
+        outside += script->peak_used - own_extent;
+    }
+    return (char *)heap_end - (char *)heap_segment_start() + outside;
+}
+
+
+/* TIMING IMPLEMENTATION */
+
+
+/* Function: read_cycles
+ * ---------------------
+ * Returns the current value of the CPU's cycle counter, or a nanosecond clock
+ * on machines without one.
+ */
+static uint64_t read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/* Function: cycles_per_second
+ * ---------------------------
+ * Measures how fast the cycle counter ticks by comparing it against the
+ * monotonic clock over CALIBRATION_NSECS, so latencies can be turned into
+ * throughput.
+ */
+static double cycles_per_second(void) {
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t start_cycles = read_cycles();
+    long elapsed;
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (now.tv_sec - start.tv_sec) * 1000000000 + (now.tv_nsec - start.tv_nsec);
+    } while (elapsed < CALIBRATION_NSECS);
+    return (read_cycles() - start_cycles) * 1e9 / elapsed;
+}
+
+/* Function: record_latency
+ * ------------------------
+ * Records the cycles elapsed since start as the latency of one call of the
+ * given request type, if the script is being timed, growing its array of
+ * latencies as needed.
+ */
+static void record_latency(script_t *script, enum request_type op, uint64_t start) {
+    uint64_t end = read_cycles();
+    if (script->timing != NULL) {
+        latencies_t *calls = &script->timing->calls[op];
+        if (calls->count == calls->capacity) {
+            calls->capacity = calls->capacity ? 2 * calls->capacity : 1024;
+            calls->cycles = realloc(calls->cycles, calls->capacity * sizeof(uint64_t));
+            if (!calls->cycles) {
                 error(1, 0, "Libc heap exhausted. Cannot continue.");
             }
-            script.ops = new_memory;
         }
+        calls->cycles[calls->count++] = end - start;
+    }
+}
 
-        script.ops[i] = parse_script_line(buffer, i, lineno, script.name);
+/* Function: init_timing
+ * ---------------------
+ * Starts timing with no latencies recorded for any request type.
+ */
+static void init_timing(timing_t *timing) {
+    memset(timing, 0, sizeof(timing_t));
+}
 
-        if (script.ops[i].id > maxid) {
-            maxid = script.ops[i].id;
+/* Function: compare_cycles
+ * ------------------------
+ * qsort comparison function for latencies in cycles.
+ */
+static int compare_cycles(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Function: print_timing
+ * ----------------------
+ * Prints, for each request type the script used, the throughput of its calls
+ * and their median, 99th percentile and maximum latency in cycles.
+ */
+static void print_timing(timing_t *timing, double cycle_rate) {
+    const char *names[NUM_REQUEST_TYPES] = {
+        [ALLOC] = "mymalloc", [FREE] = "myfree", [REALLOC] = "myrealloc",
+        [ARENA_CREATE] = "arena_create", [ARENA_ALLOC] = "arena_alloc", 
+        [ARENA_MARK] = "arena_mark", [ARENA_RELEASE] = "arena_release", 
+        [ARENA_RESET] = "arena_reset", [ALIGNED_ALLOC] = "myposix_memalign",
+        [CALLOC] = "mycalloc", [SIZED_FREE] = "myfree_sized",
+        [BATCH_ALLOC] = "mymalloc_batch", [BATCH_FREE] = "myfree_batch"
+    };
+    for (int op = ALLOC; op < NUM_REQUEST_TYPES; op++) {
+        latencies_t *calls = &timing->calls[op];
+        if (calls->count == 0) {
+            continue;
         }
+        qsort(calls->cycles, calls->count, sizeof(uint64_t), compare_cycles);
+        double total = 0;
+        for (size_t i = 0; i < calls->count; i++) {
+            total += calls->cycles[i];
+        }
+        printf("\n  %-16s %9zu calls %12.0f ops/sec   p50/p99/max = %" PRIu64 "/%" 
+            PRIu64 "/%" PRIu64 " cycles", names[op], calls->count, 
+            total > 0 ? calls->count * cycle_rate / total : 0, 
+            calls->cycles[(calls->count - 1) / 2],
+            calls->cycles[(calls->count - 1) * 99 / 100], calls->cycles[calls->count - 1]);
+    }
+}
 
-        script.num_ops = i + 1;
+/* Function: free_timing
+ * ---------------------
+ * Frees the latency arrays allocated by record_latency.
+ */
+static void free_timing(timing_t *timing) {
+    for (int op = 0; op < NUM_REQUEST_TYPES; op++) {
+        free(timing->calls[op].cycles);
     }
+}
+
+
+/* SCRIPT PARSING IMPLEMENTATION */
+
+
+/* Fuction: parse_script
+ * ---------------------
+ * This function loads the script file at the specified path, and returns an
+ * object with info about it.  A binary trace is mapped into memory and used
+ * without parsing; any other file is parsed as a text script with one request
+ * per line.  This function throws an error if the file can't be opened, if it
+ * is malformed, or if it is too long to store each request on the heap.
+ */
+static script_t parse_script(const char *path) {
+    // Initialize a script object to store the information about this script
+    script_t script = { .ops = NULL, .blocks = NULL, .num_ops = 0, .peak_size = 0};
+    const char *basename = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    strncpy(script.name, basename, sizeof(script.name) - 1);
+    script.name[sizeof(script.name) - 1] = '\0';
 
-    fclose(fp);
-    script.num_ids = maxid + 1;
+    script.ops = map_binary_trace(path, &script.num_ops, &script.num_ids);
+    script.mapped = script.ops != NULL;
+    if (!script.mapped) {
+        script.ops = read_text_script(path, &script.num_ops, &script.num_ids);
+    }
 
     script.blocks = calloc(script.num_ids, sizeof(block_t));
     if (!script.blocks) {
@@ -482,67 +1847,82 @@ static script_t parse_script(const char *path) {
     return script;
 }
 
-/* Function: read_line
- * --------------------
- * This function reads one line from the specified file and stores at most
- * buffer_size characters from it in buffer, removing any trailing newline.
- * It skips lines that are all-whitespace or that contain comments (begin with
- * # as first non-whitespace character).  When reading a line, it increments the
- * counter pointed to by `pnread` once for each line read/skipped. This function
- * returns true if did read a valid line eventually, or false otherwise.
- */
-static bool read_line(char buffer[], size_t buffer_size, FILE *fp, 
-    int *pnread) {
-
-    while (true) {
-        if (fgets(buffer, buffer_size, fp) == NULL) {
-            return false;
-        }
-
-        (*pnread)++;
-
-        // remove any trailing newline
-        if (buffer[strlen(buffer)-1] == '\n') {
-            buffer[strlen(buffer)-1] ='\0'; 
-        }
+/* Function: shard_script
+ * ----------------------
+ * Returns a loaded script holding, in their original order, the requests of
+ * whole whose ids are congruent to shard mod nshards, with arena requests
+ * sharded by their arena instead.  Shards of one script use disjoint ids and
+ * arenas, so they can be replayed at once without sharing blocks.  A batch
+ * request's ids fall in different shards, so it is split into one malloc or
+ * free per id.
+ */
+static script_t shard_script(const script_t *whole, int shard, int nshards) {
+    script_t script = { .ops = NULL, .blocks = NULL, .num_ops = 0, .peak_size = 0};
+    snprintf(script.name, sizeof(script.name), "%.96s shard %d/%d", whole->name, 
+        shard, nshards);
 
-        /* Stop only if this line is not a comment line (comment lines start
-         * with # as first non-whitespace character)
-         */
-        char ch;
-        if (sscanf(buffer, " %c", &ch) == 1 && ch != '#') {
-            return true;
+    long max_ops = 0;
+    for (int i = 0; i < whole->num_ops; i++) {
+        max_ops += request_last_id(&whole->ops[i]) - whole->ops[i].id + 1;
+    }
+    request_t *ops = malloc(max_ops * sizeof(request_t));
+    script.blocks = calloc(whole->num_ids, sizeof(block_t));
+    if (!ops || !script.blocks) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    for (int i = 0; i < whole->num_ops; i++) {
+        const request_t *request = &whole->ops[i];
+        bool arena_request = request->op >= ARENA_CREATE && request->op <= ARENA_RESET;
+        if (request->op == BATCH_ALLOC || request->op == BATCH_FREE) {
+            for (int id = request->id; id <= request_last_id(request); id++) {
+                if (id % nshards == shard) {
+                    request_t single = *request;
+                    single.op = request->op == BATCH_ALLOC ? ALLOC : FREE;
+                    single.aux = 0;
+                    single.id = id;
+                    ops[script.num_ops++] = single;
+                }
+            }
+        } else if ((arena_request ? request->aux : request->id) % nshards == shard) {
+            ops[script.num_ops++] = *request;
         }
     }
+    script.ops = ops;
+    script.num_ids = whole->num_ids;
+    return script;
 }
 
-/* Function: parse_script_line
- * ---------------------------
- * This function parses the provided line from the script and returns info
- * about it as a request_t object filled in with the type of the request,
- * the size, the ID, and the line number.  If the line is malformed, this
- * function throws an error.
+/* Function: free_script
+ * ---------------------
+ * Releases a script's requests and block table.
  */
-static request_t parse_script_line(char *buffer, int i, int lineno, 
-    char *script_name) {
-
-    request_t request = { .lineno = lineno, .op = 0, .size = 0};
-
-    char request_char;
-    int nscanned = sscanf(buffer, " %c %d %zu", &request_char, 
-        &request.id, &request.size);
-    if (request_char == 'a' && nscanned == 3) {
-        request.op = ALLOC;
-    } else if (request_char == 'r' && nscanned == 3) {
-        request.op = REALLOC;
-    } else if (request_char == 'f' && nscanned == 2) {
-        request.op = FREE;
+static void free_script(script_t *script) {
+    if (script->mapped) {
+        unmap_binary_trace(script->ops, script->num_ops);
+    } else if (!script->path) {
+        free((request_t *)script->ops);
     }
-
-    if (!request.op || request.id < 0 || request.size > MAX_REQUEST_SIZE) {
-        error(1, 0, "Line %d of script file '%s' is malformed.", 
-            lineno, script_name);
+    free(script->blocks);
+    free(script->id_map.ids);
+    free(script->id_map.entries);
+    for (int k = 0; k < script->num_arenas; k++) {
+        free(script->arenas[k].entries);
+        free(script->arenas[k].marks);
     }
+    free(script->arenas);
+}
 
-    return request;
+/* Function: open_streamed_script
+ * ------------------------------
+ * This function returns an object for the script at the specified path that
+ * is streamed while it runs rather than loaded up front.  Its requests and
+ * block table are set up by each run.
+ */
+static script_t open_streamed_script(const char *path) {
+    script_t script = { .ops = NULL, .blocks = NULL, .num_ops = 0, .peak_size = 0};
+    const char *basename = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    strncpy(script.name, basename, sizeof(script.name) - 1);
+    script.name[sizeof(script.name) - 1] = '\0';
+    script.path = path;
+    return script;
 }